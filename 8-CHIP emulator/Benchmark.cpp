@@ -0,0 +1,110 @@
+#include "Benchmark.h"
+#include <chrono>
+#include <algorithm>
+#include <memory>
+#include <iomanip>
+#include <SDL.h>
+#include "imgui.h"
+#include "imgui_sdl.h"
+
+int RunBenchmark(const std::vector<std::string> &games, const std::vector<Engine> &engines, const long long &cycles) {
+	// Instructions per RunCycles call, keeps the batches in the range of an int
+	const int batch = 1000000;
+
+	if (games.empty()) {
+		std::cout << "Usage: --benchmark [--engine <name>] [--cycles <count>] <game> [<game> ...]" << std::endl;
+		return 1;
+	}
+
+	int result = 0;
+	for (const std::string &game : games)
+	{
+		for (const Engine &engine : engines)
+		{
+			std::unique_ptr<Chip8> chip8(new Chip8());
+			chip8->SetEngine(engine);
+			if (!chip8->LoadGame(game)) {
+				result = 1;
+				break;
+			}
+
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			long long executed = 0;
+			while (executed < cycles)
+			{
+				const int count = static_cast<int>(std::min<long long>(batch, cycles - executed));
+				chip8->RunCycles(count, false);
+				executed += count;
+			}
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+			std::cout << std::dec << std::left << std::setw(10) << GetEngineName(engine)
+				<< std::right << std::setw(14) << std::fixed << std::setprecision(0) << executed / elapsed.count() << " instructions/s"
+				<< std::setw(10) << std::setprecision(3) << elapsed.count() << " s  " << game
+				<< (engine == Engine::JIT && !chip8->IsJitAvailable() ? "  (JIT unavailable, ran the cached engine)" : "") << std::endl;
+		}
+	}
+
+	return result;
+}
+
+int RunUiBenchmark(const int &frames) {
+	const int width = 1280;
+	const int height = 640;
+
+	SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_ARGB8888);
+	SDL_Renderer *renderer = surface != nullptr ? SDL_CreateSoftwareRenderer(surface) : nullptr;
+	if (renderer == nullptr) {
+		std::cout << "Could not create the software renderer: " << SDL_GetError() << std::endl;
+		return 1;
+	}
+
+	ImGui::CreateContext();
+	ImGui::GetIO().IniFilename = nullptr;
+	ImGuiSDL::Initialize(renderer, width, height);
+	ImGuiSDL::SetGeometryEnabled(false);
+
+	// The demo window next to a color picker covers text, rectangles, gradients and rounded shapes
+	const auto build = []() {
+		ImGui::GetIO().DeltaTime = 1.0f / 60.0f;
+		ImGui::NewFrame();
+		ImGui::SetNextWindowPos(ImVec2(0, 0));
+		ImGui::SetNextWindowSize(ImVec2(640, 640));
+		ImGui::ShowDemoWindow();
+		ImGui::SetNextWindowPos(ImVec2(640, 0));
+		ImGui::SetNextWindowSize(ImVec2(640, 640));
+		if (ImGui::Begin("Color")) {
+			static float color[4] = { 1.0f, 0.5f, 0.25f, 1.0f };
+			ImGui::ColorPicker4("Pixel color", color);
+		}
+		ImGui::End();
+		ImGui::Render();
+	};
+
+	// The first frames settle the layout
+	for (int i = 0; i < 3; i++)
+	{
+		build();
+	}
+
+	double elapsed = 0.0;
+	long long triangles = 0;
+	for (int i = 0; i < frames; i++)
+	{
+		build();
+		ImGuiSDL::ClearCache(true);
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		ImGuiSDL::Render(ImGui::GetDrawData());
+		elapsed += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		triangles += ImGui::GetDrawData()->TotalIdxCount / 3;
+	}
+
+	std::cout << std::fixed << std::setprecision(3) << elapsed / std::max(frames, 1) << " ms/frame  "
+		<< triangles / std::max(frames, 1) << " triangles/frame  " << frames << " frames" << std::endl;
+
+	ImGuiSDL::Deinitialize();
+	ImGui::DestroyContext();
+	SDL_DestroyRenderer(renderer);
+	SDL_FreeSurface(surface);
+	return 0;
+}
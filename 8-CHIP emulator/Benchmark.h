@@ -0,0 +1,9 @@
+#pragma once
+#include "Chip8.h"
+#include <vector>
+
+// Runs every game with every engine without a window and prints the instructions per second
+int RunBenchmark(const std::vector<std::string> &games, const std::vector<Engine> &engines, const long long &cycles);
+// Renders a synthetic UI with imgui_sdl on an off screen software renderer and prints the time per frame. The triangle caches
+// are cleared every frame and the geometry batches are off, so every triangle goes through the rasterizer.
+int RunUiBenchmark(const int &frames);
@@ -1,16 +1,122 @@
 #include "Chip8.h"
+#include "Chip8Jit.h"
 #include <limits>
+#include <algorithm>
 #include <fstream>
 #include <vector>
 
 std::random_device rd;
 std::mt19937 mt(rd());
-std::uniform_int_distribution<int> random(0, 255);
+std::uniform_int_distribution<int> random_byte(0, 255);
+
+Chip8::Handler Chip8::dispatch_table[16 * 256];
+const bool Chip8::dispatch_table_built = Chip8::BuildDispatchTable();
+
+std::string GetEngineName(const Engine &engine) {
+	switch (engine)
+	{
+	case Engine::TABLE:
+		return "table";
+	case Engine::CACHED:
+		return "cached";
+	case Engine::JIT:
+		return "jit";
+	case Engine::THREADED:
+		return "threaded";
+	default:
+		return "switch";
+	}
+}
+
+bool ParseEngine(const std::string &name, Engine &engine) {
+	if (name == "switch") {
+		engine = Engine::SWITCH;
+	}
+	else if (name == "table") {
+		engine = Engine::TABLE;
+	}
+	else if (name == "cached") {
+		engine = Engine::CACHED;
+	}
+	else if (name == "jit") {
+		engine = Engine::JIT;
+	}
+	else if (name == "threaded") {
+		engine = Engine::THREADED;
+	}
+	else {
+		return false;
+	}
+	return true;
+}
 
 Chip8::Chip8() {
+	clock_speed = 600;
+	engine = Engine::SWITCH;
 	Reset();
 }
 
+Chip8::~Chip8() {
+}
+
+bool Chip8::BuildDispatchTable() {
+	// Families decoded by the high nibble alone fill all of their 256 entries
+	const Handler families[16] = {
+		&Chip8::Op0NNN, &Chip8::Op1NNN, &Chip8::Op2NNN, &Chip8::Op3XNN,
+		&Chip8::Op4XNN, &Chip8::Op5XY0, &Chip8::Op6XNN, &Chip8::Op7XNN,
+		&Chip8::OpUnknown, &Chip8::Op9XY0, &Chip8::OpANNN, &Chip8::OpBNNN,
+		&Chip8::OpCXNN, &Chip8::OpDXYN, &Chip8::OpUnknown, &Chip8::OpUnknown
+	};
+	for (int i = 0; i < 16 * 256; i++)
+	{
+		dispatch_table[i] = families[i >> 8];
+	}
+
+	// 0x00NN
+	dispatch_table[0x0E0] = &Chip8::Op00E0;
+	dispatch_table[0x0EE] = &Chip8::Op00EE;
+
+	// 0x8XYN, the low byte also holds Y
+	const Handler arithmetic[16] = {
+		&Chip8::Op8XY0, &Chip8::Op8XY1, &Chip8::Op8XY2, &Chip8::Op8XY3,
+		&Chip8::Op8XY4, &Chip8::Op8XY5, &Chip8::Op8XY6, &Chip8::Op8XY7,
+		&Chip8::OpUnknown, &Chip8::OpUnknown, &Chip8::OpUnknown, &Chip8::OpUnknown,
+		&Chip8::OpUnknown, &Chip8::OpUnknown, &Chip8::Op8XYE, &Chip8::OpUnknown
+	};
+	for (int i = 0; i < 256; i++)
+	{
+		dispatch_table[0x800 | i] = arithmetic[i & 0xF];
+	}
+
+	// 0xEXNN
+	dispatch_table[0xE9E] = &Chip8::OpEX9E;
+	dispatch_table[0xEA1] = &Chip8::OpEXA1;
+
+	// 0xFXNN
+	dispatch_table[0xF07] = &Chip8::OpFX07;
+	dispatch_table[0xF0A] = &Chip8::OpFX0A;
+	dispatch_table[0xF15] = &Chip8::OpFX15;
+	dispatch_table[0xF18] = &Chip8::OpFX18;
+	dispatch_table[0xF1E] = &Chip8::OpFX1E;
+	dispatch_table[0xF29] = &Chip8::OpFX29;
+	dispatch_table[0xF33] = &Chip8::OpFX33;
+	dispatch_table[0xF55] = &Chip8::OpFX55;
+	dispatch_table[0xF65] = &Chip8::OpFX65;
+
+	return true;
+}
+
+Instruction Chip8::Decode(const unsigned short &opcode) {
+	Instruction instruction;
+	instruction.opcode = opcode;
+	instruction.nnn = opcode & 0x0FFF;
+	instruction.x = (opcode & 0x0F00) >> 8;
+	instruction.y = (opcode & 0x00F0) >> 4;
+	instruction.n = opcode & 0x000F;
+	instruction.nn = opcode & 0x00FF;
+	return instruction;
+}
+
 void Chip8::Reset() {
 	// Program counter starts at 0x200
 	pc = 0x200;
@@ -18,7 +124,8 @@ void Chip8::Reset() {
 	opcode = 0;
 	I = 0;
 	sp = 0;
-	draw_flag = false;
+	dirty_rows = 0xFFFFFFFF;
+	observed_keys = 0;
 	std::fill(std::begin(memory), std::end(memory), 0);
 	std::fill(std::begin(V), std::end(V), 0);
 	std::fill(std::begin(gfx), std::end(gfx), 0);
@@ -30,15 +137,213 @@ void Chip8::Reset() {
 	{
 		memory[i] = chip8_fontset[i];
 	}
+	InvalidateCode(0, 4096);
 
 	// Reset timers
 	delay_timer = 60;
 	sound_timer = 60;
+	timer_accumulator = 0;
+	jit_overshoot = 0;
 
 	state = State::ON;
 }
 
 void Chip8::EmulateCycle(const bool &sound) {
+	RunCycles(1, sound);
+}
+
+void Chip8::RunCycles(const int &cycles, const bool &sound) {
+	// Branch on the engine once per batch instead of once per instruction
+	switch (engine)
+	{
+	case Engine::TABLE:
+		Run<&Chip8::ExecuteTable>(cycles, sound);
+		break;
+	case Engine::CACHED:
+		Run<&Chip8::ExecuteCached>(cycles, sound);
+		break;
+	case Engine::JIT:
+		RunJit(cycles, sound);
+		break;
+	case Engine::THREADED:
+		RunThreaded(cycles, sound);
+		break;
+	default:
+		Run<&Chip8::ExecuteSwitch>(cycles, sound);
+		break;
+	}
+}
+
+template <void (Chip8::*Execute)()> void Chip8::Run(const int &cycles, const bool &sound) {
+	for (int i = 0; i < cycles; i++)
+	{
+		(this->*Execute)();
+		AdvanceTimers(1, sound);
+	}
+}
+
+Chip8Jit &Chip8::GetJit() {
+	if (!jit) {
+		const char *base = reinterpret_cast<const char*>(this);
+		jit.reset(new Chip8Jit(reinterpret_cast<const char*>(V) - base, reinterpret_cast<const char*>(&I) - base, reinterpret_cast<const char*>(&pc) - base));
+	}
+	return *jit;
+}
+
+bool Chip8::IsJitAvailable() {
+	return GetJit().IsAvailable();
+}
+
+void Chip8::RunJit(const int &cycles, const bool &sound) {
+	Chip8Jit &recompiler = GetJit();
+
+	// Blocks run whole, whatever a block runs past the end of the batch is taken from the next one
+	int remaining = cycles - jit_overshoot;
+	while (remaining > 0)
+	{
+		Chip8Jit::BlockFunction block = pc < 4096 ? recompiler.GetBlock(memory, pc) : nullptr;
+		int executed = 1;
+		if (block != nullptr) {
+			executed = block(this);
+		}
+		else {
+			ExecuteCached();
+		}
+
+		remaining -= executed;
+		AdvanceTimers(executed, sound);
+	}
+	jit_overshoot = -remaining;
+}
+
+void Chip8::RunThreaded(const int &cycles, const bool &sound) {
+#if defined(__GNUC__)
+	// Threaded code with labels as values (GCC and Clang), every opcode family ends in its own
+	// indirect jump so the branch predictor can learn the sequences of the game
+	static void *const families[16] = {
+		&&family_0, &&family_1, &&family_2, &&family_3, &&family_4, &&family_5, &&family_6, &&family_7,
+		&&family_8, &&family_9, &&family_A, &&family_B, &&family_C, &&family_D, &&family_E, &&family_F
+	};
+	static void *const arithmetic[16] = {
+		&&arithmetic_0, &&arithmetic_1, &&arithmetic_2, &&arithmetic_3, &&arithmetic_4, &&arithmetic_5, &&arithmetic_6, &&arithmetic_7,
+		&&unknown, &&unknown, &&unknown, &&unknown, &&unknown, &&unknown, &&arithmetic_E, &&unknown
+	};
+
+	int remaining = cycles;
+	Instruction instruction;
+
+#define DISPATCH() \
+	opcode = memory[pc] << 8 | memory[pc + 1]; \
+	pc += 2; \
+	instruction = Decode(opcode); \
+	goto *families[opcode >> 12]
+
+#define NEXT() \
+	AdvanceTimers(1, sound); \
+	if (--remaining <= 0) { \
+		return; \
+	} \
+	DISPATCH()
+
+	if (remaining <= 0) {
+		return;
+	}
+	DISPATCH();
+
+family_0:
+family_E:
+family_F:
+	// Families with sparse sub-opcodes go through the dispatch table
+	(this->*dispatch_table[((opcode & 0xF000) >> 4) | (opcode & 0x00FF)])(instruction);
+	NEXT();
+family_1:
+	Op1NNN(instruction);
+	NEXT();
+family_2:
+	Op2NNN(instruction);
+	NEXT();
+family_3:
+	Op3XNN(instruction);
+	NEXT();
+family_4:
+	Op4XNN(instruction);
+	NEXT();
+family_5:
+	Op5XY0(instruction);
+	NEXT();
+family_6:
+	Op6XNN(instruction);
+	NEXT();
+family_7:
+	Op7XNN(instruction);
+	NEXT();
+family_8:
+	goto *arithmetic[instruction.n];
+arithmetic_0:
+	Op8XY0(instruction);
+	NEXT();
+arithmetic_1:
+	Op8XY1(instruction);
+	NEXT();
+arithmetic_2:
+	Op8XY2(instruction);
+	NEXT();
+arithmetic_3:
+	Op8XY3(instruction);
+	NEXT();
+arithmetic_4:
+	Op8XY4(instruction);
+	NEXT();
+arithmetic_5:
+	Op8XY5(instruction);
+	NEXT();
+arithmetic_6:
+	Op8XY6(instruction);
+	NEXT();
+arithmetic_7:
+	Op8XY7(instruction);
+	NEXT();
+arithmetic_E:
+	Op8XYE(instruction);
+	NEXT();
+family_9:
+	Op9XY0(instruction);
+	NEXT();
+family_A:
+	OpANNN(instruction);
+	NEXT();
+family_B:
+	OpBNNN(instruction);
+	NEXT();
+family_C:
+	OpCXNN(instruction);
+	NEXT();
+family_D:
+	OpDXYN(instruction);
+	NEXT();
+unknown:
+	OpUnknown(instruction);
+	NEXT();
+
+#undef NEXT
+#undef DISPATCH
+#else
+	// Labels as values are not available (MSVC), the cached engine is the closest match
+	Run<&Chip8::ExecuteCached>(cycles, sound);
+#endif
+}
+
+void Chip8::AdvanceTimers(const int &cycles, const bool &sound) {
+	// Every instruction is 1 / clock_speed seconds of emulated time
+	timer_accumulator += 60 * cycles;
+	while (timer_accumulator >= clock_speed)
+	{
+		timer_accumulator -= clock_speed;
+		UpdateTimers(sound);
+	}
+}
+
+void Chip8::ExecuteSwitch() {
 	// Fetch opcode (2 bytes)
 	opcode = memory[pc] << 8 | memory[pc + 1];
 	pc += 2;
@@ -49,7 +354,7 @@ void Chip8::EmulateCycle(const bool &sound) {
 		{
 		case 0x00E0: // 0x00E0	disp_clear()
 			std::fill(std::begin(gfx), std::end(gfx), 0);
-			draw_flag = true;
+			dirty_rows = 0xFFFFFFFF;
 			break;
 		case 0x00EE: // 0x00EE	return;
 			pc = stack[--sp] + 2;
@@ -161,44 +466,10 @@ void Chip8::EmulateCycle(const bool &sound) {
 		pc = (opcode & 0x0FFF) + V[0];
 		break;
 	case 0xC000: //0xCXNN	Vx = rand() & NN
-		V[(opcode & 0x0F00) >> 8] = random(mt) & (opcode & 0x00FF);
+		V[(opcode & 0x0F00) >> 8] = random_byte(mt) & (opcode & 0x00FF);
 		break;
 	case 0xD000: //0xDXYN	draw(Vx,Vy,N)
-	{
-		unsigned short x = V[(opcode & 0x0F00) >> 8];
-		unsigned short y = V[(opcode & 0x00F0) >> 4];
-		unsigned short height = opcode & 0x000F;
-		unsigned short pixel;
-
-		V[0xF] = 0;
-		for (int row = 0; row < height; row++)
-		{
-			pixel = memory[I + row];
-			for (int column = 0; column < 8; column++)
-			{
-				if ((pixel & (0x80 >> column)) != 0)
-				{
-					int index = x + column + ((y + row) * 64);
-					// Prevent VERS crash and possibly others games
-					if (index >= (32 * 64)) {
-						while (index >= (32 * 64))
-						{
-							std::cout << "Index: " << index << std::endl;
-							index /= (32 * 64);
-						}
-					}
-					if (gfx[index] == 1)
-					{
-						V[0xF] = 1;
-					}
-					
-					gfx[index] ^= 1;
-				}
-			}
-		}
-
-		draw_flag = true;
-	}
+		DrawSprite(V[(opcode & 0x0F00) >> 8], V[(opcode & 0x00F0) >> 4], opcode & 0x000F);
 		break;
 	case 0xE000: //0xEXNN
 		switch (opcode & 0x00FF)
@@ -206,6 +477,7 @@ void Chip8::EmulateCycle(const bool &sound) {
 		case 0x009E: //0xEX9E	if(key() == Vx)
 			if (key[V[(opcode & 0x0F00) >> 8]] != 0)
 			{
+				observed_keys |= 1 << (V[(opcode & 0x0F00) >> 8] & 0xF);
 				pc += 2;
 			}
 			break;
@@ -214,6 +486,9 @@ void Chip8::EmulateCycle(const bool &sound) {
 			{
 				pc += 2;
 			}
+			else {
+				observed_keys |= 1 << (V[(opcode & 0x0F00) >> 8] & 0xF);
+			}
 			break;
 		default:
 			std::cout << std::hex << "\033[1;31mUnknown (0xE000) opcode:\033[0m 0x" << opcode << std::endl;
@@ -234,6 +509,7 @@ void Chip8::EmulateCycle(const bool &sound) {
 			{
 				if (key[i] != 0) {
 					V[(opcode & 0x0F00) >> 8] = i;
+					observed_keys |= 1 << i;
 					key_pressed = true;
 				}
 			}
@@ -266,12 +542,14 @@ void Chip8::EmulateCycle(const bool &sound) {
 			memory[I] = V[(opcode & 0x0F00) >> 8] / 100;
 			memory[I + 1] = (V[(opcode & 0x0F00) >> 8] / 10) % 10;
 			memory[I + 2] = V[(opcode & 0x0F00) >> 8] % 10;
+			InvalidateCode(I, 3);
 			break;
 		case 0x0055: // 0xFX55	reg_dump(Vx, &I)
 			for (int i = 0; i <= ((opcode & 0x0F00) >> 8); i++)
 			{
 				memory[I + i] = V[i];
 			}
+			InvalidateCode(I, ((opcode & 0x0F00) >> 8) + 1);
 			// I += ((opcode & 0x0F00) >> 8) + 1; Original chip8 interpreter
 			break;
 		case 0x0065: // 0xFX65	reg_load(Vx, &I)
@@ -290,8 +568,9 @@ void Chip8::EmulateCycle(const bool &sound) {
 		std::cout << std::hex << "\033[1;31mUnknown opcode \033[0m: 0x" << opcode << std::endl;
 		break;
 	}
+}
 
-	//
+void Chip8::UpdateTimers(const bool &sound) {
 	if (delay_timer > 0) {
 		delay_timer--;
 	}
@@ -303,6 +582,271 @@ void Chip8::EmulateCycle(const bool &sound) {
 	}
 }
 
+void Chip8::ExecuteTable() {
+	// Fetch opcode (2 bytes)
+	opcode = memory[pc] << 8 | memory[pc + 1];
+	pc += 2;
+	(this->*dispatch_table[((opcode & 0xF000) >> 4) | (opcode & 0x00FF)])(Decode(opcode));
+}
+
+void Chip8::ExecuteCached() {
+	// Steady state: one load and one indirect call, the decoding was done once
+	const DecodedInstruction &entry = decoded[pc & 0xFFF];
+	pc += 2;
+	(this->*entry.handler)(entry.instruction);
+}
+
+void Chip8::DecodeAt(const int &address) {
+	const unsigned short value = memory[address] << 8 | memory[(address + 1) & 0xFFF];
+	decoded[address].instruction = Decode(value);
+	decoded[address].handler = dispatch_table[((value & 0xF000) >> 4) | (value & 0x00FF)];
+}
+
+void Chip8::InvalidateCode(const int &address, const int &length) {
+	// The instruction starting one byte before the write also reads the first written byte
+	const int first = std::max(address - 1, 0);
+	const int last = std::min(address + length, 4096);
+	for (int i = first; i < last; i++)
+	{
+		decoded[i].handler = &Chip8::OpDecode;
+	}
+
+	if (jit) {
+		jit->Invalidate(address, length);
+	}
+}
+
+void Chip8::Op0NNN(const Instruction &instruction) {
+	std::cout << std::hex << "\033[1;31mOpcode (0x0NNN) not implemented, PC: " << pc << ", opcode:\033[0m 0x" << instruction.opcode << std::endl;
+}
+
+void Chip8::Op00E0(const Instruction &instruction) { // disp_clear()
+	std::fill(std::begin(gfx), std::end(gfx), 0);
+	dirty_rows = 0xFFFFFFFF;
+}
+
+void Chip8::Op00EE(const Instruction &instruction) { // return;
+	pc = stack[--sp] + 2;
+}
+
+void Chip8::Op1NNN(const Instruction &instruction) { // goto NNN
+	pc = instruction.nnn;
+}
+
+void Chip8::Op2NNN(const Instruction &instruction) { // *(0xNNN)()
+	stack[sp++] = pc - 2;
+	pc = instruction.nnn;
+}
+
+void Chip8::Op3XNN(const Instruction &instruction) { // if(Vx == NN)
+	if (V[instruction.x] == instruction.nn)
+	{
+		pc += 2;
+	}
+}
+
+void Chip8::Op4XNN(const Instruction &instruction) { // if(Vx != NN)
+	if (V[instruction.x] != instruction.nn)
+	{
+		pc += 2;
+	}
+}
+
+void Chip8::Op5XY0(const Instruction &instruction) { // if(Vx == Vy)
+	if (V[instruction.x] == V[instruction.y])
+	{
+		pc += 2;
+	}
+}
+
+void Chip8::Op6XNN(const Instruction &instruction) { // Vx = NN
+	V[instruction.x] = instruction.nn;
+}
+
+void Chip8::Op7XNN(const Instruction &instruction) { // Vx += NN
+	V[instruction.x] += instruction.nn;
+}
+
+void Chip8::Op8XY0(const Instruction &instruction) { // Vx = Vy
+	V[instruction.x] = V[instruction.y];
+}
+
+void Chip8::Op8XY1(const Instruction &instruction) { // Vx = Vx | Vy
+	V[instruction.x] |= V[instruction.y];
+}
+
+void Chip8::Op8XY2(const Instruction &instruction) { // Vx = Vx & Vy
+	V[instruction.x] &= V[instruction.y];
+}
+
+void Chip8::Op8XY3(const Instruction &instruction) { // Vx = Vx ^ Vy
+	V[instruction.x] ^= V[instruction.y];
+}
+
+void Chip8::Op8XY4(const Instruction &instruction) { // Vx += Vy
+	V[0xF] = V[instruction.x] + V[instruction.y] > 0xFF ? 1 : 0;
+	V[instruction.x] += V[instruction.y];
+}
+
+void Chip8::Op8XY5(const Instruction &instruction) { // Vx -= Vy
+	V[0xF] = V[instruction.x] < V[instruction.y] ? 0 : 1;
+	V[instruction.x] -= V[instruction.y];
+}
+
+void Chip8::Op8XY6(const Instruction &instruction) { // Vx >>= 1
+	V[0xF] = V[instruction.x] & 0x1;
+	V[instruction.x] >>= 1;
+}
+
+void Chip8::Op8XY7(const Instruction &instruction) { // Vx = Vy - Vx
+	V[0xF] = V[instruction.y] < V[instruction.x] ? 0 : 1;
+	V[instruction.x] = V[instruction.y] - V[instruction.x];
+}
+
+void Chip8::Op8XYE(const Instruction &instruction) { // Vx <<= 1
+	V[0xF] = V[instruction.x] >> 7;
+	V[instruction.x] <<= 1;
+}
+
+void Chip8::Op9XY0(const Instruction &instruction) { // if(Vx != Vy)
+	if (V[instruction.x] != V[instruction.y])
+	{
+		pc += 2;
+	}
+}
+
+void Chip8::OpANNN(const Instruction &instruction) { // I = NNN
+	I = instruction.nnn;
+}
+
+void Chip8::OpBNNN(const Instruction &instruction) { // PC = V0 + NNN
+	pc = instruction.nnn + V[0];
+}
+
+void Chip8::OpCXNN(const Instruction &instruction) { // Vx = rand() & NN
+	V[instruction.x] = random_byte(mt) & instruction.nn;
+}
+
+void Chip8::OpDXYN(const Instruction &instruction) { // draw(Vx,Vy,N)
+	DrawSprite(V[instruction.x], V[instruction.y], instruction.n);
+}
+
+void Chip8::DrawSprite(const int &x, const int &y, const int &height) {
+	// Each sprite row is placed with one rotation, so it wraps around the right edge,
+	// rows below the bottom edge wrap to the top
+	const int column = x % 64;
+
+	V[0xF] = 0;
+	for (int row = 0; row < height; row++)
+	{
+		const uint64_t sprite = static_cast<uint64_t>(memory[I + row]) << 56;
+		const uint64_t line = column == 0 ? sprite : (sprite >> column) | (sprite << (64 - column));
+		const int target_row = (y + row) % 32;
+		uint64_t &target = gfx[target_row];
+
+		if ((target & line) != 0)
+		{
+			V[0xF] = 1;
+		}
+		target ^= line;
+		if (line != 0) {
+			dirty_rows |= 1u << target_row;
+		}
+	}
+}
+
+void Chip8::OpEX9E(const Instruction &instruction) { // if(key() == Vx)
+	if (key[V[instruction.x]] != 0)
+	{
+		observed_keys |= 1 << (V[instruction.x] & 0xF);
+		pc += 2;
+	}
+}
+
+void Chip8::OpEXA1(const Instruction &instruction) { // if(key() != Vx)
+	if (key[V[instruction.x]] == 0)
+	{
+		pc += 2;
+	}
+	else {
+		observed_keys |= 1 << (V[instruction.x] & 0xF);
+	}
+}
+
+void Chip8::OpFX07(const Instruction &instruction) { // Vx = get_delay()
+	V[instruction.x] = delay_timer;
+}
+
+void Chip8::OpFX0A(const Instruction &instruction) { // Vx = get_key()
+	bool key_pressed = false;
+
+	for (int i = 0; i < 16; i++)
+	{
+		if (key[i] != 0) {
+			V[instruction.x] = i;
+			observed_keys |= 1 << i;
+			key_pressed = true;
+		}
+	}
+	if (!key_pressed) {
+		pc -= 2;
+	}
+}
+
+void Chip8::OpFX15(const Instruction &instruction) { // delay_timer(Vx)
+	delay_timer = V[instruction.x];
+}
+
+void Chip8::OpFX18(const Instruction &instruction) { // sound_timer(Vx)
+	sound_timer = V[instruction.x];
+}
+
+void Chip8::OpFX1E(const Instruction &instruction) { // I += Vx
+	// For Commodore Amiga carry flag is set
+	V[0xF] = I + V[instruction.x] > 0xFFF ? 1 : 0;
+	I += V[instruction.x];
+}
+
+void Chip8::OpFX29(const Instruction &instruction) { // I = sprite_addr[Vx]
+	I = V[instruction.x] * 0x5;
+}
+
+void Chip8::OpFX33(const Instruction &instruction) { // set_BCD(Vx)
+	memory[I] = V[instruction.x] / 100;
+	memory[I + 1] = (V[instruction.x] / 10) % 10;
+	memory[I + 2] = V[instruction.x] % 10;
+	InvalidateCode(I, 3);
+}
+
+void Chip8::OpFX55(const Instruction &instruction) { // reg_dump(Vx, &I)
+	for (int i = 0; i <= instruction.x; i++)
+	{
+		memory[I + i] = V[i];
+	}
+	InvalidateCode(I, instruction.x + 1);
+}
+
+void Chip8::OpFX65(const Instruction &instruction) { // reg_load(Vx, &I)
+	for (int i = 0; i <= instruction.x; i++)
+	{
+		V[i] = memory[I + i];
+	}
+}
+
+void Chip8::OpUnknown(const Instruction &instruction) {
+	std::cout << std::hex << "\033[1;31mUnknown opcode \033[0m: 0x" << instruction.opcode << std::endl;
+}
+
+void Chip8::OpDecode(const Instruction &instruction) {
+	// First run of this address since it was written, decode it and run the real handler
+	const int address = (pc - 2) & 0xFFF;
+	DecodeAt(address);
+
+	const DecodedInstruction &entry = decoded[address];
+	opcode = entry.instruction.opcode;
+	(this->*entry.handler)(entry.instruction);
+}
+
 bool Chip8::LoadGame(const std::string& dir) {
 	std::ifstream game(dir, std::ios::binary);
 
@@ -317,6 +861,14 @@ bool Chip8::LoadGame(const std::string& dir) {
 			memory[i + 512] = buffer[i];
 		}
 
+		InvalidateCode(512, static_cast<int>(buffer.size()));
+
+		// Decode the whole program up front
+		for (int i = 0; i < 4096; i++)
+		{
+			DecodeAt(i);
+		}
+
 		return true;
 	}
 	else {
@@ -325,22 +877,54 @@ bool Chip8::LoadGame(const std::string& dir) {
 	}
 }
 
-bool Chip8::GetDrawFlag() {
-	return draw_flag;
+uint32_t Chip8::GetDirtyRows() {
+	return dirty_rows;
+}
+
+void Chip8::SetDirtyRows(const uint32_t &dirty_rows) {
+	this->dirty_rows = dirty_rows;
 }
 
-void Chip8::SetDrawFlag(const bool& draw_flag) {
-	this->draw_flag = draw_flag;
+uint16_t Chip8::TakeObservedKeys() {
+	const uint16_t keys = observed_keys;
+	observed_keys = 0;
+	return keys;
 }
 
 unsigned char Chip8::GetPixel(const int &position) {
-	return gfx[position];
+	return (gfx[position / 64] >> (63 - position % 64)) & 1;
+}
+
+uint64_t Chip8::GetRow(const int &row) {
+	return gfx[row];
 }
 
 State Chip8::GetState() {
 	return state;
 }
 
+Engine Chip8::GetEngine() {
+	return engine;
+}
+
+void Chip8::SetEngine(const Engine &engine) {
+	this->engine = engine;
+	// The overshoot belongs to the batch the JIT ran last
+	jit_overshoot = 0;
+}
+
+int Chip8::GetClockSpeed() {
+	return clock_speed;
+}
+
+void Chip8::SetClockSpeed(const int &clock_speed) {
+	if (clock_speed > 0 && clock_speed != this->clock_speed) {
+		// Keep the progress towards the next tick when the speed changes
+		timer_accumulator = static_cast<int>(static_cast<long long>(timer_accumulator) * clock_speed / this->clock_speed);
+		this->clock_speed = clock_speed;
+	}
+}
+
 void Chip8::SetState(const State& state) {
 	this->state = state;
 }
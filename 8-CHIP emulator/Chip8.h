@@ -2,6 +2,9 @@
 #include <string>
 #include <iostream>
 #include <random>
+#include <memory>
+
+class Chip8Jit;
 
 enum class State
 {
@@ -9,6 +12,32 @@ enum class State
 	OFF
 };
 
+// Instruction decoding and dispatch strategy used by the CPU
+enum class Engine
+{
+	SWITCH,
+	TABLE,
+	CACHED,
+	JIT,
+	THREADED
+};
+
+const Engine chip8_engines[] = { Engine::SWITCH, Engine::TABLE, Engine::CACHED, Engine::JIT, Engine::THREADED };
+
+std::string GetEngineName(const Engine &engine);
+bool ParseEngine(const std::string &name, Engine &engine);
+
+// Opcode with all of its operands already extracted
+struct Instruction
+{
+	unsigned short opcode;
+	unsigned short nnn;
+	uint8_t x;
+	uint8_t y;
+	uint8_t n;
+	uint8_t nn;
+};
+
 const unsigned char chip8_fontset[80] =
 {
   0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
@@ -40,31 +69,123 @@ private:
 	unsigned short I;
 	// Program counter
 	unsigned short pc;
-	// Pixel state
-	unsigned char gfx[64 * 32];
+	// Pixel state, one row per word with the leftmost pixel in the highest bit
+	uint64_t gfx[32];
 	// Timers
 	unsigned char delay_timer;
 	unsigned char sound_timer;
+	// Emulated CPU clock (instructions per second)
+	int clock_speed;
+	// Timer scheduler, the timers tick every clock_speed / 60 instructions
+	int timer_accumulator;
 	// Stack for storing the program counter
 	unsigned short stack[16];
 	// Stack counter
 	unsigned short sp;
 	// Keyboard
 	unsigned char key[16];
-	// Draw flag
-	bool draw_flag;
+	// Pressed keys read by EX9E, EXA1 or FX0A since the last TakeObservedKeys, one bit per key
+	uint16_t observed_keys;
+	// Rows changed since the display was last uploaded, one bit per row
+	uint32_t dirty_rows;
 	// State of the emulator
 	State state;
+	// Dispatch strategy
+	Engine engine;
+
+	typedef void (Chip8::*Handler)(const Instruction &instruction);
+	// Handlers indexed by the high nibble and the low byte of the opcode (0xF0NN)
+	static Handler dispatch_table[16 * 256];
+	static const bool dispatch_table_built;
+	static bool BuildDispatchTable();
+	static Instruction Decode(const unsigned short &opcode);
+
+	// Decoded instruction for every address, invalid entries point to OpDecode
+	struct DecodedInstruction
+	{
+		Handler handler;
+		Instruction instruction;
+	};
+	DecodedInstruction decoded[4096];
+	void DecodeAt(const int &address);
+	// Drops the decoded instructions and translated blocks that read the written bytes
+	void InvalidateCode(const int &address, const int &length);
+
+	// Recompiler, created the first time the JIT engine runs
+	std::unique_ptr<Chip8Jit> jit;
+	// Instructions a block ran past the end of the last batch
+	int jit_overshoot;
+
+	Chip8Jit &GetJit();
+	template <void (Chip8::*Execute)()> void Run(const int &cycles, const bool &sound);
+	void RunJit(const int &cycles, const bool &sound);
+	void RunThreaded(const int &cycles, const bool &sound);
+	void AdvanceTimers(const int &cycles, const bool &sound);
+	void ExecuteSwitch();
+	void ExecuteTable();
+	void ExecuteCached();
+	void UpdateTimers(const bool &sound);
+	void DrawSprite(const int &x, const int &y, const int &height);
+
+	// Opcode handlers
+	void Op0NNN(const Instruction &instruction);
+	void Op00E0(const Instruction &instruction);
+	void Op00EE(const Instruction &instruction);
+	void Op1NNN(const Instruction &instruction);
+	void Op2NNN(const Instruction &instruction);
+	void Op3XNN(const Instruction &instruction);
+	void Op4XNN(const Instruction &instruction);
+	void Op5XY0(const Instruction &instruction);
+	void Op6XNN(const Instruction &instruction);
+	void Op7XNN(const Instruction &instruction);
+	void Op8XY0(const Instruction &instruction);
+	void Op8XY1(const Instruction &instruction);
+	void Op8XY2(const Instruction &instruction);
+	void Op8XY3(const Instruction &instruction);
+	void Op8XY4(const Instruction &instruction);
+	void Op8XY5(const Instruction &instruction);
+	void Op8XY6(const Instruction &instruction);
+	void Op8XY7(const Instruction &instruction);
+	void Op8XYE(const Instruction &instruction);
+	void Op9XY0(const Instruction &instruction);
+	void OpANNN(const Instruction &instruction);
+	void OpBNNN(const Instruction &instruction);
+	void OpCXNN(const Instruction &instruction);
+	void OpDXYN(const Instruction &instruction);
+	void OpEX9E(const Instruction &instruction);
+	void OpEXA1(const Instruction &instruction);
+	void OpFX07(const Instruction &instruction);
+	void OpFX0A(const Instruction &instruction);
+	void OpFX15(const Instruction &instruction);
+	void OpFX18(const Instruction &instruction);
+	void OpFX1E(const Instruction &instruction);
+	void OpFX29(const Instruction &instruction);
+	void OpFX33(const Instruction &instruction);
+	void OpFX55(const Instruction &instruction);
+	void OpFX65(const Instruction &instruction);
+	void OpUnknown(const Instruction &instruction);
+	void OpDecode(const Instruction &instruction);
 public:
 	Chip8();
+	~Chip8();
 	void Reset();
 	bool LoadGame(const std::string& dir);
 	void EmulateCycle(const bool &sound_timer);
+	// Executes a batch of instructions, the timers tick at 60Hz of emulated time
+	void RunCycles(const int &cycles, const bool &sound_timer);
 
-	bool GetDrawFlag();
+	uint32_t GetDirtyRows();
+	uint16_t TakeObservedKeys();
 	State GetState();
+	int GetClockSpeed();
+	Engine GetEngine();
+	// False when the JIT engine has no executable memory (or no x86-64 CPU) and runs the cached engine instead
+	bool IsJitAvailable();
 	unsigned char GetPixel(const int &position);
-	void SetDrawFlag(const bool& draw_flag);
+	uint64_t GetRow(const int &row);
+	void SetDirtyRows(const uint32_t &dirty_rows);
 	void SetState(const State &state);
+	void SetClockSpeed(const int &clock_speed);
+	void SetEngine(const Engine &engine);
 	void SetKey(const int &index, const bool &pressed);
 };
\ No newline at end of file
@@ -0,0 +1,341 @@
+#include "Chip8Jit.h"
+#include <algorithm>
+#include <iostream>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define CHIP8_JIT_X64
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+	// x86-64 register numbers
+	const uint8_t EAX = 0;
+	const uint8_t ECX = 1;
+	const uint8_t EDX = 2;
+
+	// Largest code a single CHIP-8 instruction translates into, with room for the prologue and the exit
+	const std::size_t MAX_INSTRUCTION_SIZE = 48;
+	const std::size_t CODE_BUFFER_SIZE = 1024 * 1024;
+}
+
+Chip8Jit::Chip8Jit(const std::ptrdiff_t &v_offset, const std::ptrdiff_t &i_offset, const std::ptrdiff_t &pc_offset) {
+	this->v_offset = static_cast<int>(v_offset);
+	this->i_offset = static_cast<int>(i_offset);
+	this->pc_offset = static_cast<int>(pc_offset);
+	code_buffer = nullptr;
+	code_size = 0;
+	code_used = 0;
+	emit = nullptr;
+
+#ifdef CHIP8_JIT_X64
+#ifdef _WIN32
+	void *memory = VirtualAlloc(nullptr, CODE_BUFFER_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+	if (memory != nullptr) {
+		code_buffer = static_cast<unsigned char*>(memory);
+		code_size = CODE_BUFFER_SIZE;
+	}
+#else
+	void *memory = mmap(nullptr, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory != MAP_FAILED) {
+		code_buffer = static_cast<unsigned char*>(memory);
+		code_size = CODE_BUFFER_SIZE;
+	}
+#endif
+	if (code_buffer == nullptr) {
+		std::cout << "\033[1;31mJIT disabled, could not allocate executable memory\033[0m" << std::endl;
+	}
+#endif
+
+	Flush();
+}
+
+Chip8Jit::~Chip8Jit() {
+	if (code_buffer != nullptr) {
+#ifdef _WIN32
+		VirtualFree(code_buffer, 0, MEM_RELEASE);
+#else
+		munmap(code_buffer, code_size);
+#endif
+	}
+}
+
+bool Chip8Jit::IsAvailable() {
+	return code_buffer != nullptr;
+}
+
+Chip8Jit::BlockFunction Chip8Jit::GetBlock(const unsigned char *memory, const int &address) {
+	if (!blocks[address].translated && code_buffer != nullptr) {
+		Translate(memory, address);
+	}
+	return blocks[address].code;
+}
+
+void Chip8Jit::Invalidate(const int &address, const int &length) {
+	const int first = std::max(address, 0);
+	const int last = std::min(address + length, 4096);
+
+	bool hit = false;
+	for (int i = first; i < last; i++)
+	{
+		hit |= covered[i];
+	}
+	if (!hit) {
+		return;
+	}
+
+	// Only blocks starting up to a whole block before the write can reach it
+	for (int i = std::max(first - 2 * MAX_BLOCK_LENGTH, 0); i < last; i++)
+	{
+		Block &block = blocks[i];
+		const int end = i + 2 * std::max<int>(block.length, 1);
+		if (block.translated && end > first) {
+			block.translated = false;
+			block.code = nullptr;
+			block.length = 0;
+		}
+	}
+}
+
+void Chip8Jit::Flush() {
+	for (int i = 0; i < 4096; i++)
+	{
+		blocks[i].code = nullptr;
+		blocks[i].length = 0;
+		blocks[i].translated = false;
+		covered[i] = false;
+	}
+	code_used = 0;
+}
+
+void Chip8Jit::Translate(const unsigned char *memory, const int &address) {
+#ifdef CHIP8_JIT_X64
+	if (code_used + MAX_BLOCK_LENGTH * MAX_INSTRUCTION_SIZE > code_size) {
+		// Out of space, start over, the blocks still in use get translated again
+		Flush();
+	}
+
+	emit = code_buffer + code_used;
+
+	// The Chip8 pointer is the first argument, keep it in r8 which is free in both calling conventions
+#ifdef _WIN32
+	Emit8(0x49); Emit8(0x89); Emit8(0xC8); // mov r8, rcx
+#else
+	Emit8(0x49); Emit8(0x89); Emit8(0xF8); // mov r8, rdi
+#endif
+
+	int count = 0;
+	int pc = address;
+	bool ended = false;
+
+	while (!ended && count < MAX_BLOCK_LENGTH && pc + 1 < 4096)
+	{
+		const unsigned short opcode = memory[pc] << 8 | memory[pc + 1];
+		const int x = (opcode & 0x0F00) >> 8;
+		const int y = (opcode & 0x00F0) >> 4;
+		const uint8_t nn = opcode & 0x00FF;
+		const uint16_t nnn = opcode & 0x0FFF;
+		bool translated = true;
+
+		switch (opcode & 0xF000)
+		{
+		case 0x1000: // 0x1NNN	goto NNN
+			EmitStoreWord(pc_offset, nnn);
+			ended = true;
+			break;
+		case 0x3000: // 0x3XNN	if(Vx == NN)
+		case 0x4000: // 0x4XNN	if(Vx != NN)
+			// cmp byte [r8 + Vx], NN
+			Emit8(0x41); Emit8(0x80); Emit8(0xB8); Emit32(v_offset + x); Emit8(nn);
+			EmitStoreWord(pc_offset, static_cast<uint16_t>(pc + 2));
+			// Both stores are 10 bytes, jump over the skip when the condition fails
+			Emit8((opcode & 0xF000) == 0x3000 ? 0x75 : 0x74); Emit8(10);
+			EmitStoreWord(pc_offset, static_cast<uint16_t>(pc + 4));
+			ended = true;
+			break;
+		case 0x5000: // 0x5XY0	if(Vx == Vy)
+		case 0x9000: // 0x9XY0	if(Vx != Vy)
+			EmitLoadV(EAX, x);
+			EmitLoadV(EDX, y);
+			Emit8(0x39); Emit8(0xD0); // cmp eax, edx
+			EmitStoreWord(pc_offset, static_cast<uint16_t>(pc + 2));
+			Emit8((opcode & 0xF000) == 0x5000 ? 0x75 : 0x74); Emit8(10);
+			EmitStoreWord(pc_offset, static_cast<uint16_t>(pc + 4));
+			ended = true;
+			break;
+		case 0x6000: // 0x6XNN	Vx = NN
+			// mov byte [r8 + Vx], NN
+			Emit8(0x41); Emit8(0xC6); Emit8(0x80); Emit32(v_offset + x); Emit8(nn);
+			break;
+		case 0x7000: // 0x7XNN	Vx += NN
+			// add byte [r8 + Vx], NN
+			Emit8(0x41); Emit8(0x80); Emit8(0x80); Emit32(v_offset + x); Emit8(nn);
+			break;
+		case 0x8000: // 0x8XYN
+			switch (opcode & 0x000F)
+			{
+			case 0x0000: // 0x8XY0	Vx = Vy
+				EmitLoadV(EAX, y);
+				EmitStoreV(x, EAX);
+				break;
+			case 0x0001: // 0x8XY1	Vx = Vx | Vy
+			case 0x0002: // 0x8XY2	Vx = Vx & Vy
+			case 0x0003: // 0x8XY3	Vx = Vx ^ Vy
+			{
+				const uint8_t operation[] = { 0x08, 0x20, 0x30 }; // or, and, xor
+				EmitLoadV(EAX, x);
+				EmitLoadV(EDX, y);
+				Emit8(operation[(opcode & 0x000F) - 1]); Emit8(0xD0); // al op= dl
+				EmitStoreV(x, EAX);
+			}
+				break;
+			// The interpreter writes VF first, so VF as an operand is left to it
+			case 0x0004: // 0x8XY4	Vx += Vy
+				if (x == 0xF || y == 0xF) {
+					translated = false;
+					break;
+				}
+				EmitLoadV(EAX, x);
+				EmitLoadV(EDX, y);
+				Emit8(0x01); Emit8(0xD0); // add eax, edx
+				EmitStoreV(x, EAX);
+				Emit8(0xC1); Emit8(0xE8); Emit8(0x08); // shr eax, 8
+				EmitStoreV(0xF, EAX);
+				break;
+			case 0x0005: // 0x8XY5	Vx -= Vy
+			case 0x0007: // 0x8XY7	Vx = Vy - Vx
+				if (x == 0xF || y == 0xF) {
+					translated = false;
+					break;
+				}
+				if ((opcode & 0x000F) == 0x0005) {
+					EmitLoadV(EAX, x);
+					EmitLoadV(EDX, y);
+				}
+				else {
+					EmitLoadV(EAX, y);
+					EmitLoadV(EDX, x);
+				}
+				Emit8(0x39); Emit8(0xD0); // cmp eax, edx
+				Emit8(0x0F); Emit8(0x93); Emit8(0xC1); // setae cl
+				Emit8(0x29); Emit8(0xD0); // sub eax, edx
+				EmitStoreV(x, EAX);
+				EmitStoreV(0xF, ECX);
+				break;
+			case 0x0006: // 0x8XY6	Vx >>= 1
+				if (x == 0xF) {
+					translated = false;
+					break;
+				}
+				EmitLoadV(EAX, x);
+				Emit8(0x89); Emit8(0xC1); // mov ecx, eax
+				Emit8(0x83); Emit8(0xE1); Emit8(0x01); // and ecx, 1
+				Emit8(0xD1); Emit8(0xE8); // shr eax, 1
+				EmitStoreV(x, EAX);
+				EmitStoreV(0xF, ECX);
+				break;
+			case 0x000E: // 0x8XYE	Vx <<= 1
+				if (x == 0xF) {
+					translated = false;
+					break;
+				}
+				EmitLoadV(EAX, x);
+				Emit8(0x89); Emit8(0xC1); // mov ecx, eax
+				Emit8(0xC1); Emit8(0xE9); Emit8(0x07); // shr ecx, 7
+				Emit8(0xD1); Emit8(0xE0); // shl eax, 1
+				EmitStoreV(x, EAX);
+				EmitStoreV(0xF, ECX);
+				break;
+			default:
+				translated = false;
+				break;
+			}
+			break;
+		case 0xA000: // 0xANNN	I = NNN
+			EmitStoreWord(i_offset, nnn);
+			break;
+		default:
+			// 2NNN, 00EE, BNNN and everything touching memory, the display, keys or timers
+			translated = false;
+			break;
+		}
+
+		if (!translated) {
+			break;
+		}
+		count++;
+		pc += 2;
+	}
+
+	Block &block = blocks[address];
+	block.translated = true;
+
+	if (count == 0) {
+		// Nothing to translate, the interpreter runs this address
+		block.code = nullptr;
+		block.length = 0;
+		return;
+	}
+
+	if (!ended) {
+		// Continue in the interpreter with the instruction that stopped the block
+		EmitStoreWord(pc_offset, static_cast<uint16_t>(pc));
+	}
+	EmitReturn(count);
+
+	block.code = reinterpret_cast<BlockFunction>(code_buffer + code_used);
+	block.length = static_cast<unsigned short>(count);
+	code_used = emit - code_buffer;
+
+	for (int i = address; i < std::min(address + 2 * count, 4096); i++)
+	{
+		covered[i] = true;
+	}
+#else
+	blocks[address].translated = true;
+	blocks[address].code = nullptr;
+	blocks[address].length = 0;
+#endif
+}
+
+void Chip8Jit::Emit8(const uint8_t &value) {
+	*emit++ = value;
+}
+
+void Chip8Jit::Emit16(const uint16_t &value) {
+	Emit8(value & 0xFF);
+	Emit8(value >> 8);
+}
+
+void Chip8Jit::Emit32(const uint32_t &value) {
+	Emit16(value & 0xFFFF);
+	Emit16(value >> 16);
+}
+
+void Chip8Jit::EmitLoadV(const uint8_t &reg, const int &x) {
+	// movzx reg, byte [r8 + Vx]
+	Emit8(0x41); Emit8(0x0F); Emit8(0xB6); Emit8(0x80 | reg << 3); Emit32(v_offset + x);
+}
+
+void Chip8Jit::EmitStoreV(const int &x, const uint8_t &reg) {
+	// mov byte [r8 + Vx], reg (low byte)
+	Emit8(0x41); Emit8(0x88); Emit8(0x80 | reg << 3); Emit32(v_offset + x);
+}
+
+void Chip8Jit::EmitStoreWord(const int &offset, const uint16_t &value) {
+	// mov word [r8 + offset], value
+	Emit8(0x66); Emit8(0x41); Emit8(0xC7); Emit8(0x80); Emit32(offset); Emit16(value);
+}
+
+void Chip8Jit::EmitReturn(const int &count) {
+	// mov eax, count; ret
+	Emit8(0xB8); Emit32(count);
+	Emit8(0xC3);
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+class Chip8;
+
+// Dynamic recompiler, translates CHIP-8 basic blocks into x86-64 code.
+// Blocks end at 1NNN, 2NNN, 00EE, BNNN, a skip or the first instruction that is not translated,
+// which is then left to the interpreter.
+class Chip8Jit {
+public:
+	// Runs a block and returns the number of CHIP-8 instructions it executed
+	typedef int (*BlockFunction)(Chip8 *chip8);
+
+	Chip8Jit(const std::ptrdiff_t &v_offset, const std::ptrdiff_t &i_offset, const std::ptrdiff_t &pc_offset);
+	~Chip8Jit();
+	Chip8Jit(const Chip8Jit&) = delete;
+	Chip8Jit& operator=(const Chip8Jit&) = delete;
+
+	bool IsAvailable();
+	// Block starting at address, translated on first use. Returns nullptr when the interpreter has to run it
+	BlockFunction GetBlock(const unsigned char *memory, const int &address);
+	// Drops every block that was translated from the written bytes
+	void Invalidate(const int &address, const int &length);
+	void Flush();
+
+	static const int MAX_BLOCK_LENGTH = 32;
+private:
+	struct Block
+	{
+		BlockFunction code;
+		unsigned short length;
+		bool translated;
+	};
+
+	Block blocks[4096];
+	// Bytes that are part of a translated block, writes anywhere else need no work
+	bool covered[4096];
+
+	// Executable memory, blocks are allocated linearly and only freed by Flush
+	unsigned char *code_buffer;
+	std::size_t code_size;
+	std::size_t code_used;
+
+	// Offsets of the registers inside Chip8
+	int v_offset;
+	int i_offset;
+	int pc_offset;
+
+	void Translate(const unsigned char *memory, const int &address);
+
+	// x86-64 emitter
+	unsigned char *emit;
+	void Emit8(const uint8_t &value);
+	void Emit16(const uint16_t &value);
+	void Emit32(const uint32_t &value);
+	void EmitLoadV(const uint8_t &reg, const int &x);
+	void EmitStoreV(const int &x, const uint8_t &reg);
+	void EmitStoreWord(const int &offset, const uint16_t &value);
+	void EmitReturn(const int &count);
+};
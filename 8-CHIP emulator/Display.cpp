@@ -0,0 +1,47 @@
+#include "Display.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define DISPLAY_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DISPLAY_SSE2
+#endif
+
+void ExpandRow(const uint64_t &row, uint32_t *destination, const uint32_t &on, const uint32_t &off) {
+#if defined(DISPLAY_AVX2)
+	// 8 pixels per step: broadcast a byte of the row and test one bit per lane
+	const __m256i bits = _mm256_setr_epi32(0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+	const __m256i on_color = _mm256_set1_epi32(static_cast<int>(on));
+	const __m256i off_color = _mm256_set1_epi32(static_cast<int>(off));
+
+	for (int i = 0; i < 8; i++)
+	{
+		const __m256i byte = _mm256_set1_epi32(static_cast<int>((row >> (56 - i * 8)) & 0xFF));
+		const __m256i mask = _mm256_cmpeq_epi32(_mm256_and_si256(byte, bits), bits);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i * 8), _mm256_blendv_epi8(off_color, on_color, mask));
+	}
+#elif defined(DISPLAY_SSE2)
+	// 4 pixels per step: broadcast a byte of the row and test one bit per lane
+	const __m128i high_bits = _mm_setr_epi32(0x80, 0x40, 0x20, 0x10);
+	const __m128i low_bits = _mm_setr_epi32(0x08, 0x04, 0x02, 0x01);
+	const __m128i on_color = _mm_set1_epi32(static_cast<int>(on));
+	const __m128i off_color = _mm_set1_epi32(static_cast<int>(off));
+
+	for (int i = 0; i < 8; i++)
+	{
+		const __m128i byte = _mm_set1_epi32(static_cast<int>((row >> (56 - i * 8)) & 0xFF));
+		const __m128i high_mask = _mm_cmpeq_epi32(_mm_and_si128(byte, high_bits), high_bits);
+		const __m128i low_mask = _mm_cmpeq_epi32(_mm_and_si128(byte, low_bits), low_bits);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i * 8),
+			_mm_or_si128(_mm_and_si128(high_mask, on_color), _mm_andnot_si128(high_mask, off_color)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i * 8 + 4),
+			_mm_or_si128(_mm_and_si128(low_mask, on_color), _mm_andnot_si128(low_mask, off_color)));
+	}
+#else
+	for (int x = 0; x < 64; x++)
+	{
+		destination[x] = ((row >> (63 - x)) & 1) != 0 ? on : off;
+	}
+#endif
+}
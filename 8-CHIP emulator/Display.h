@@ -0,0 +1,6 @@
+#pragma once
+#include <cstdint>
+
+// Expands a display row (leftmost pixel in the highest bit) into 64 ARGB8888 pixels.
+// Uses AVX2 or SSE2 when the compiler targets them, otherwise plain C++.
+void ExpandRow(const uint64_t &row, uint32_t *destination, const uint32_t &on, const uint32_t &off);
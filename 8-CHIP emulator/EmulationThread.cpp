@@ -0,0 +1,228 @@
+#include "EmulationThread.h"
+#include <chrono>
+#include <algorithm>
+
+FrameBuffer::FrameBuffer() : shared(1), back(0), front(2) {
+	for (Frame &frame : frames)
+	{
+		std::fill(std::begin(frame.rows), std::end(frame.rows), 0);
+		frame.number = 0;
+	}
+}
+
+Frame &FrameBuffer::GetBack() {
+	return frames[back];
+}
+
+void FrameBuffer::Publish() {
+	// Release makes the rows visible to the reader that takes this frame
+	back = shared.exchange(static_cast<uint8_t>(back | FRESH), std::memory_order_acq_rel) & ~FRESH;
+}
+
+bool FrameBuffer::Acquire() {
+	if ((shared.load(std::memory_order_relaxed) & FRESH) == 0) {
+		return false;
+	}
+	front = shared.exchange(front, std::memory_order_acq_rel) & ~FRESH;
+	return true;
+}
+
+const Frame &FrameBuffer::GetFront() {
+	return frames[front];
+}
+
+KeyQueue::KeyQueue() : head(0), tail(0), overflow(0) {
+}
+
+void KeyQueue::Push(const KeyEvent &event) {
+	const unsigned int position = tail.load(std::memory_order_relaxed);
+	if (overflow.load(std::memory_order_acquire) == 0 && position - head.load(std::memory_order_acquire) != CAPACITY) {
+		events[position % CAPACITY] = event;
+		tail.store(position + 1, std::memory_order_release);
+		return;
+	}
+
+	// Keep only the latest state of the key, the timestamp is lost
+	const uint32_t bit = 1u << event.key;
+	uint32_t current = overflow.load(std::memory_order_relaxed);
+	uint32_t updated;
+	do
+	{
+		updated = (current | bit) & ~(bit << 16);
+		if (event.pressed) {
+			updated |= bit << 16;
+		}
+	} while (!overflow.compare_exchange_weak(current, updated, std::memory_order_acq_rel));
+}
+
+bool KeyQueue::Peek(KeyEvent &event) {
+	const unsigned int position = head.load(std::memory_order_relaxed);
+	if (position == tail.load(std::memory_order_acquire)) {
+		return false;
+	}
+	event = events[position % CAPACITY];
+	return true;
+}
+
+bool KeyQueue::Pop(KeyEvent &event) {
+	if (!Peek(event)) {
+		return false;
+	}
+	head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	return true;
+}
+
+uint32_t KeyQueue::TakeOverflow() {
+	if (overflow.load(std::memory_order_relaxed) == 0) {
+		return 0;
+	}
+	return overflow.exchange(0, std::memory_order_acq_rel);
+}
+
+EmulationThread::EmulationThread(Chip8 &chip8) : chip8(chip8), running(false), active(false), sound(true), instructions_per_frame(10), frame_number(0) {
+}
+
+EmulationThread::~EmulationThread() {
+	Stop();
+}
+
+void EmulationThread::Start() {
+	if (!running.exchange(true)) {
+		thread = std::thread(&EmulationThread::Loop, this);
+	}
+}
+
+void EmulationThread::Stop() {
+	running = false;
+	if (thread.joinable()) {
+		thread.join();
+	}
+}
+
+std::unique_lock<std::mutex> EmulationThread::Lock() {
+	return std::unique_lock<std::mutex>(mutex);
+}
+
+FrameBuffer &EmulationThread::GetFrames() {
+	return frames;
+}
+
+KeyQueue &EmulationThread::GetKeys() {
+	return keys;
+}
+
+LatencyTracker &EmulationThread::GetLatency() {
+	return latency;
+}
+
+void EmulationThread::Loop() {
+	const std::chrono::steady_clock::duration period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / 60.0));
+	std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+
+	while (running)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (active) {
+				// The frame running now stands for the period that just ended
+				RunFrame(next - period, period);
+			}
+			else {
+				KeyEvent event;
+				while (keys.Pop(event))
+				{
+					ApplyKey(event);
+				}
+				ApplyOverflow();
+			}
+			const uint16_t observed_keys = chip8.TakeObservedKeys();
+			if (observed_keys != 0) {
+				latency.KeysObserved(observed_keys, std::chrono::steady_clock::now());
+			}
+
+			// Only frames that changed the display are handed to the renderer
+			if (chip8.GetDirtyRows() != 0) {
+				chip8.SetDirtyRows(0);
+				Frame &frame = frames.GetBack();
+				for (int y = 0; y < 32; y++)
+				{
+					frame.rows[y] = chip8.GetRow(y);
+				}
+				frame.number = ++frame_number;
+				frames.Publish();
+				latency.FramePublished(frame_number, std::chrono::steady_clock::now());
+			}
+		}
+
+		// Fixed cadence on the monotonic clock, after a long stall (debugger, suspended machine)
+		// start over instead of running all the missed frames at once
+		next += period;
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (now - next > std::chrono::milliseconds(200)) {
+			next = now;
+		}
+		std::this_thread::sleep_until(next);
+	}
+}
+
+void EmulationThread::RunFrame(const std::chrono::steady_clock::time_point &start, const std::chrono::steady_clock::duration &period) {
+	const int cycles = instructions_per_frame;
+	chip8.SetClockSpeed(cycles * 60);
+
+	// Run up to the cycle every key event belongs to, so a tap shorter than a frame still spans
+	// the instructions in between. Events from before the frame (a stall) land on its first cycle,
+	// events from after it stay for the next frame. The JIT runs whole blocks, so there the key
+	// can change a few instructions late.
+	int executed = 0;
+	KeyEvent event;
+	bool pending = false;
+	while ((pending = keys.Peek(event)) && event.timestamp < start + period)
+	{
+		int cycle = 0;
+		if (event.timestamp > start) {
+			cycle = static_cast<int>((event.timestamp - start).count() * cycles / period.count());
+		}
+		if (cycle > executed) {
+			chip8.RunCycles(cycle - executed, sound);
+			executed = cycle;
+		}
+		ApplyKey(event);
+		keys.Pop(event);
+	}
+	// The overflowed keys are newer than anything queued
+	if (!pending) {
+		ApplyOverflow();
+	}
+	if (executed < cycles) {
+		chip8.RunCycles(cycles - executed, sound);
+	}
+}
+
+void EmulationThread::ApplyKey(const KeyEvent &event) {
+	chip8.SetKey(event.key, event.pressed);
+	if (event.pressed) {
+		latency.KeyApplied(event.key, event.timestamp, std::chrono::steady_clock::now());
+	}
+}
+
+void EmulationThread::ApplyOverflow() {
+	const uint32_t overflow = keys.TakeOverflow();
+	for (uint8_t key = 0; key < 16; key++)
+	{
+		if (overflow & (1u << key)) {
+			chip8.SetKey(key, (overflow & (1u << (16 + key))) != 0);
+		}
+	}
+}
+
+void EmulationThread::SetActive(const bool &active) {
+	this->active = active;
+}
+
+void EmulationThread::SetSound(const bool &sound) {
+	this->sound = sound;
+}
+
+void EmulationThread::SetInstructionsPerFrame(const int &instructions_per_frame) {
+	this->instructions_per_frame = instructions_per_frame;
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include "Chip8.h"
+#include "Latency.h"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+// Display published by the emulation thread
+struct Frame
+{
+	// One row per word with the leftmost pixel in the highest bit, like Chip8::GetRow
+	uint64_t rows[32];
+	// Increases with every published frame
+	unsigned long long number;
+};
+
+// Lock-free triple buffer with a single writer and a single reader. The writer fills the back
+// frame and swaps it with the shared one, the reader swaps the shared frame with the front one
+// when a new frame is waiting, so neither side ever waits for the other.
+class FrameBuffer
+{
+private:
+	Frame frames[3];
+	// Index of the shared frame, FRESH is set while it holds a frame the reader has not taken
+	std::atomic<uint8_t> shared;
+	uint8_t back;
+	uint8_t front;
+	static const uint8_t FRESH = 4;
+public:
+	FrameBuffer();
+	// Writer side
+	Frame &GetBack();
+	void Publish();
+	// Reader side, returns false when there is no newer frame than the front one
+	bool Acquire();
+	const Frame &GetFront();
+};
+
+// Key transition with the host time it happened at
+struct KeyEvent
+{
+	std::chrono::steady_clock::time_point timestamp;
+	uint8_t key;
+	bool pressed;
+};
+
+// Lock-free ring buffer with a single producer (the event loop) and a single consumer (the emulation thread)
+class KeyQueue
+{
+private:
+	static const unsigned int CAPACITY = 64;
+	KeyEvent events[CAPACITY];
+	// Free running positions, the slot is the position modulo CAPACITY
+	std::atomic<unsigned int> head;
+	std::atomic<unsigned int> tail;
+	// Keys whose latest transition did not fit in the ring, one bit per key, with the key's
+	// state at bit 16 + key. Once set every transition goes here until the consumer takes it,
+	// so it is always newer than the queued events and a release is never lost.
+	std::atomic<uint32_t> overflow;
+public:
+	KeyQueue();
+	// Producer side, a transition that does not fit is kept as the key's latest state instead
+	void Push(const KeyEvent &event);
+	// Consumer side, returns false when the queue is empty
+	bool Peek(KeyEvent &event);
+	bool Pop(KeyEvent &event);
+	// Consumer side, only once the queue is empty. Returns the overflowed keys in the low
+	// 16 bits and their state in the high ones, and clears them.
+	uint32_t TakeOverflow();
+};
+
+// Runs the CHIP-8 core on its own thread at 60 frames per second of emulated time, takes the
+// keys from a KeyQueue and publishes the display through a FrameBuffer. Everything else that
+// touches the core from another thread has to hold the lock returned by Lock().
+class EmulationThread
+{
+private:
+	Chip8 &chip8;
+	FrameBuffer frames;
+	KeyQueue keys;
+	LatencyTracker latency;
+	std::thread thread;
+	std::mutex mutex;
+	std::atomic<bool> running;
+	std::atomic<bool> active;
+	std::atomic<bool> sound;
+	std::atomic<int> instructions_per_frame;
+	unsigned long long frame_number;
+
+	void Loop();
+	void RunFrame(const std::chrono::steady_clock::time_point &start, const std::chrono::steady_clock::duration &period);
+	void ApplyKey(const KeyEvent &event);
+	void ApplyOverflow();
+public:
+	EmulationThread(Chip8 &chip8);
+	~EmulationThread();
+	void Start();
+	void Stop();
+	std::unique_lock<std::mutex> Lock();
+	FrameBuffer &GetFrames();
+	// Key transitions are applied at the cycle of the frame they happened at
+	KeyQueue &GetKeys();
+	// The renderer reports the presented frames to it
+	LatencyTracker &GetLatency();
+
+	// Runs the game when true, the thread keeps publishing the display while inactive
+	void SetActive(const bool &active);
+	void SetSound(const bool &sound);
+	void SetInstructionsPerFrame(const int &instructions_per_frame);
+};
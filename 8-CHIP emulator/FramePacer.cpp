@@ -0,0 +1,123 @@
+#include "FramePacer.h"
+#include <algorithm>
+#include <iterator>
+#include <thread>
+
+FramePacer::FramePacer() : vsync(false), spin_margin(std::chrono::milliseconds(2)), last_frame_time(1.0 / 60.0) {
+	SetTargetFps(60);
+	deadline = Clock::now();
+	last_frame = deadline;
+	ResetStats();
+}
+
+void FramePacer::SetTargetFps(const int &fps) {
+	if (fps > 0) {
+		period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / fps));
+	}
+}
+
+void FramePacer::SetVsync(const bool &vsync) {
+	this->vsync = vsync;
+}
+
+bool FramePacer::GetVsync() {
+	return vsync;
+}
+
+void FramePacer::Wait() {
+	if (!vsync) {
+		deadline += period;
+		Clock::time_point now = Clock::now();
+		if (now - deadline > period) {
+			// More than a frame late (a blocking dialog, a dragged window), start over instead of rushing
+			deadline = now;
+		}
+		else {
+			const Clock::time_point wake = deadline - spin_margin;
+			if (wake > now) {
+				std::this_thread::sleep_until(wake);
+				now = Clock::now();
+				// Sleeps that end late push the spinning earlier, it drops back slowly
+				const Clock::duration oversleep = now - wake;
+				spin_margin = std::max(oversleep, spin_margin - spin_margin / 100);
+				spin_margin = std::min<Clock::duration>(spin_margin, std::chrono::milliseconds(4));
+			}
+			while (now < deadline)
+			{
+				std::this_thread::yield();
+				now = Clock::now();
+			}
+		}
+	}
+
+	const Clock::time_point now = Clock::now();
+	Record(std::chrono::duration<double, std::milli>(now - last_frame).count());
+	last_frame = now;
+
+	fps_frames++;
+	const double elapsed = std::chrono::duration<double>(now - fps_start).count();
+	if (elapsed >= 1.0) {
+		fps = fps_frames / elapsed;
+		fps_frames = 0;
+		fps_start = now;
+	}
+}
+
+void FramePacer::Resume() {
+	deadline = Clock::now();
+	last_frame = deadline;
+}
+
+void FramePacer::Record(const double &frame_time) {
+	last_frame_time = frame_time / 1000.0;
+	histogram[std::min(HISTOGRAM_BUCKETS - 1, static_cast<int>(frame_time / BUCKET_WIDTH))]++;
+	frames++;
+	total += frame_time;
+	minimum = std::min(minimum, frame_time);
+	maximum = std::max(maximum, frame_time);
+}
+
+double FramePacer::Percentile(const double &percentile) {
+	// Upper edge of the bucket that holds the percentile
+	const long long rank = static_cast<long long>(percentile / 100.0 * frames);
+	long long count = 0;
+	for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+	{
+		count += histogram[i];
+		if (count > rank) {
+			return (i + 1) * BUCKET_WIDTH;
+		}
+	}
+	return HISTOGRAM_BUCKETS * BUCKET_WIDTH;
+}
+
+double FramePacer::GetLastFrameTime() {
+	return last_frame_time;
+}
+
+FramePacerStats FramePacer::GetStats() {
+	FramePacerStats stats;
+	stats.frames = frames;
+	stats.average = frames > 0 ? total / frames : 0.0;
+	stats.minimum = frames > 0 ? minimum : 0.0;
+	stats.maximum = maximum;
+	stats.p50 = frames > 0 ? Percentile(50.0) : 0.0;
+	stats.p99 = frames > 0 ? Percentile(99.0) : 0.0;
+	stats.fps = fps;
+	return stats;
+}
+
+const long long *FramePacer::GetHistogram() {
+	return histogram;
+}
+
+void FramePacer::ResetStats() {
+	std::fill(std::begin(histogram), std::end(histogram), 0);
+	frames = 0;
+	total = 0.0;
+	minimum = 1e9;
+	maximum = 0.0;
+	fps_start = Clock::now();
+	fps_frames = 0;
+	fps = 0.0;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <chrono>
+
+// Frame time statistics since the last ResetStats
+struct FramePacerStats
+{
+	long long frames;
+	// Milliseconds
+	double average;
+	double minimum;
+	double maximum;
+	double p50;
+	double p99;
+	// Frames per second over the last second
+	double fps;
+};
+
+// Keeps the render loop at a target frame rate on the monotonic clock. Frames are scheduled on
+// fixed deadlines so rounding never accumulates, the wait sleeps until shortly before the
+// deadline and spins the rest. With vsync the presentation already waits, the pacer only measures.
+class FramePacer
+{
+public:
+	// Histogram buckets of 0.25ms, the last one also counts every longer frame
+	static const int HISTOGRAM_BUCKETS = 200;
+	static constexpr double BUCKET_WIDTH = 0.25;
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	Clock::duration period;
+	Clock::time_point deadline;
+	Clock::time_point last_frame;
+	bool vsync;
+	// How long before the deadline the sleep ends, follows how late the sleeps wake up
+	Clock::duration spin_margin;
+
+	double last_frame_time;
+	long long histogram[HISTOGRAM_BUCKETS];
+	long long frames;
+	double total;
+	double minimum;
+	double maximum;
+	// Frames counted for the FPS readout
+	Clock::time_point fps_start;
+	int fps_frames;
+	double fps;
+
+	void Record(const double &frame_time);
+	double Percentile(const double &percentile);
+public:
+	FramePacer();
+	void SetTargetFps(const int &fps);
+	void SetVsync(const bool &vsync);
+	bool GetVsync();
+	// Waits for the start of the next frame and records the length of the one that ended
+	void Wait();
+	// Starts the next frame now without recording anything, after the caller waited on its own
+	void Resume();
+	// Seconds
+	double GetLastFrameTime();
+	FramePacerStats GetStats();
+	const long long *GetHistogram();
+	void ResetStats();
+};
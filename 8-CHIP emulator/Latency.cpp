@@ -0,0 +1,128 @@
+#include "Latency.h"
+#include <algorithm>
+#include <fstream>
+
+LatencyTracker::LatencyTracker() : next_sample(0) {
+	for (Probe &probe : probes)
+	{
+		probe.stage = Stage::IDLE;
+	}
+}
+
+double LatencyTracker::Milliseconds(const TimePoint &from, const TimePoint &to) {
+	return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+void LatencyTracker::KeyApplied(const int &key, const TimePoint &event, const TimePoint &now) {
+	std::lock_guard<std::mutex> lock(mutex);
+	Probe &probe = probes[key & 0xF];
+	probe.stage = Stage::APPLIED;
+	probe.event = event;
+	probe.sample.key = key & 0xF;
+	probe.sample.applied = Milliseconds(event, now);
+}
+
+void LatencyTracker::KeysObserved(const uint16_t &keys, const TimePoint &now) {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (int i = 0; i < 16; i++)
+	{
+		if ((keys & (1 << i)) != 0 && probes[i].stage == Stage::APPLIED) {
+			probes[i].stage = Stage::OBSERVED;
+			probes[i].sample.observed = Milliseconds(probes[i].event, now);
+		}
+	}
+}
+
+void LatencyTracker::FramePublished(const unsigned long long &frame, const TimePoint &now) {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (Probe &probe : probes)
+	{
+		if (probe.stage == Stage::OBSERVED) {
+			probe.stage = Stage::CHANGED;
+			probe.sample.changed = Milliseconds(probe.event, now);
+			probe.frame = frame;
+		}
+	}
+}
+
+void LatencyTracker::FramePresented(const unsigned long long &frame, const TimePoint &now) {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (Probe &probe : probes)
+	{
+		// The renderer can skip frames, a newer one carries the change as well
+		if (probe.stage == Stage::CHANGED && probe.frame <= frame) {
+			probe.stage = Stage::IDLE;
+			probe.sample.presented = Milliseconds(probe.event, now);
+			if (samples.size() < MAX_SAMPLES) {
+				samples.push_back(probe.sample);
+			}
+			else {
+				samples[next_sample] = probe.sample;
+			}
+			next_sample = (next_sample + 1) % MAX_SAMPLES;
+		}
+	}
+}
+
+size_t LatencyTracker::GetSampleCount() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return samples.size();
+}
+
+void LatencyTracker::GetPercentiles(LatencyPercentiles percentiles[4]) {
+	std::vector<double> values[4];
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (const LatencySample &sample : samples)
+		{
+			values[0].push_back(sample.applied);
+			values[1].push_back(sample.observed);
+			values[2].push_back(sample.changed);
+			values[3].push_back(sample.presented);
+		}
+	}
+
+	for (int i = 0; i < 4; i++)
+	{
+		std::vector<double> &stage = values[i];
+		if (stage.empty()) {
+			percentiles[i] = LatencyPercentiles{ 0.0, 0.0, 0.0 };
+			continue;
+		}
+		std::sort(stage.begin(), stage.end());
+		// Nearest rank
+		const auto rank = [&stage](const double &percentile) {
+			const size_t index = static_cast<size_t>(percentile / 100.0 * stage.size() + 0.5);
+			return stage[std::min(stage.size() - 1, index > 0 ? index - 1 : 0)];
+		};
+		percentiles[i] = LatencyPercentiles{ rank(50.0), rank(95.0), rank(99.0) };
+	}
+}
+
+bool LatencyTracker::WriteCsv(const std::string &path) {
+	std::ofstream file(path);
+	if (!file.is_open()) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	file << "key,applied_ms,observed_ms,changed_ms,presented_ms" << std::endl;
+	// Oldest first
+	const size_t start = samples.size() < MAX_SAMPLES ? 0 : next_sample;
+	for (size_t i = 0; i < samples.size(); i++)
+	{
+		const LatencySample &sample = samples[(start + i) % samples.size()];
+		file << sample.key << "," << sample.applied << "," << sample.observed << "," << sample.changed << "," << sample.presented << std::endl;
+	}
+	return file.good();
+}
+
+void LatencyTracker::Clear() {
+	std::lock_guard<std::mutex> lock(mutex);
+	samples.clear();
+	next_sample = 0;
+	for (Probe &probe : probes)
+	{
+		probe.stage = Stage::IDLE;
+	}
+}
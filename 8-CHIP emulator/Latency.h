@@ -0,0 +1,78 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Times of one key press, in milliseconds since SDL received the key
+struct LatencySample
+{
+	int key;
+	// Chip8::SetKey ran on the emulation thread
+	double applied;
+	// First EX9E, EXA1 or FX0A that read the key
+	double observed;
+	// First frame that changed the display after that
+	double changed;
+	// SDL_RenderPresent of that frame
+	double presented;
+};
+
+// Percentiles of one stage of the samples
+struct LatencyPercentiles
+{
+	double p50;
+	double p95;
+	double p99;
+};
+
+// Follows key presses from the SDL event to the presented frame. The emulation thread reports
+// the first three stages and the render thread the last one, a press the game never reads or
+// that never changes the display is dropped when the same key is pressed again.
+class LatencyTracker
+{
+private:
+	typedef std::chrono::steady_clock::time_point TimePoint;
+
+	enum class Stage
+	{
+		IDLE,
+		APPLIED,
+		OBSERVED,
+		CHANGED
+	};
+	// Press of one key on its way through the stages
+	struct Probe
+	{
+		Stage stage;
+		TimePoint event;
+		LatencySample sample;
+		unsigned long long frame;
+	};
+
+	static const size_t MAX_SAMPLES = 4096;
+
+	std::mutex mutex;
+	Probe probes[16];
+	// Oldest samples are overwritten once MAX_SAMPLES are stored
+	std::vector<LatencySample> samples;
+	size_t next_sample;
+
+	static double Milliseconds(const TimePoint &from, const TimePoint &to);
+public:
+	LatencyTracker();
+
+	// Emulation thread
+	void KeyApplied(const int &key, const TimePoint &event, const TimePoint &now);
+	void KeysObserved(const uint16_t &keys, const TimePoint &now);
+	void FramePublished(const unsigned long long &frame, const TimePoint &now);
+	// Render thread
+	void FramePresented(const unsigned long long &frame, const TimePoint &now);
+
+	size_t GetSampleCount();
+	// p50, p95 and p99 of the applied, observed, changed and presented stages
+	void GetPercentiles(LatencyPercentiles percentiles[4]);
+	bool WriteCsv(const std::string &path);
+	void Clear();
+};
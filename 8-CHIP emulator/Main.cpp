@@ -1,5 +1,9 @@
 #include <SDL.h>
 #include "Chip8.h"
+#include "Benchmark.h"
+#include "Display.h"
+#include "EmulationThread.h"
+#include "FramePacer.h"
 #include <chrono>
 #include <thread>
 // https://github.com/ocornut/imgui
@@ -11,18 +15,33 @@
 
 unsigned long createRGB(int r, int g, int b, int a = 0xFF);
 void ShowInformation();
+void ShowLatency();
+void ShowFrameTimes();
 void ShowMenu();
 bool SelectGame();
+SDL_Renderer* CreateRenderer(SDL_Window* window);
 
 const std::string VERSION = "v1.0";
 const int WIDTH = 1280;
 const int HEIGHT = 640;
+// While paused or stopped the loop sleeps until an event, but wakes up this often to pick up a new display
+const int IDLE_WAIT_MS = 100;
+// Frames drawn after an event while idle, ImGui needs a few to settle hovering and opening menus
+const int IDLE_SETTLE_FRAMES = 3;
 
 int max_fps = 60;
+bool vsync = false;
+// auto, accelerated or software
+std::string renderer_type = "auto";
+std::string renderer_name = "";
+int instructions_per_frame = 10;
 bool game_loaded = false;
 bool sound_timer = true;
 bool game_paused = false;
 bool imgui_visible = true;
+bool latency_visible = false;
+bool frame_times_visible = false;
+bool idle_sleep = true;
 std::string current_game = "";
 
 unsigned long pixel_color = 0xFFFFFFFF;
@@ -47,9 +66,68 @@ uint8_t keymap[16] = {
     SDLK_v, // F
 };
 
-Chip8 chip8 = Chip8();
+Chip8 chip8;
+EmulationThread emulation(chip8);
+FramePacer pacer;
 
 int main(int argc, char* args[]) {
+    bool benchmark = false;
+    bool benchmark_ui = false;
+    int benchmark_frames = 200;
+    long long benchmark_cycles = 50000000;
+    std::vector<std::string> benchmark_games;
+    std::vector<Engine> benchmark_engines;
+
+    // Command line
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = args[i];
+        if (arg == "--engine" && i + 1 < argc) {
+            Engine engine;
+            if (!ParseEngine(args[++i], engine)) {
+                std::cout << "Unknown engine: " << args[i] << std::endl;
+                return 1;
+            }
+            chip8.SetEngine(engine);
+            benchmark_engines.push_back(engine);
+        }
+        else if (arg == "--benchmark") {
+            benchmark = true;
+        }
+        else if (arg == "--benchmark-ui") {
+            benchmark_ui = true;
+        }
+        else if (arg == "--frames" && i + 1 < argc) {
+            benchmark_frames = std::stoi(args[++i]);
+        }
+        else if (arg == "--renderer" && i + 1 < argc) {
+            renderer_type = args[++i];
+            if (renderer_type != "auto" && renderer_type != "accelerated" && renderer_type != "software") {
+                std::cout << "Unknown renderer: " << renderer_type << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--vsync") {
+            vsync = true;
+        }
+        else if (arg == "--cycles" && i + 1 < argc) {
+            benchmark_cycles = std::stoll(args[++i]);
+        }
+        else if (benchmark) {
+            benchmark_games.push_back(arg);
+        }
+    }
+
+    if (benchmark_ui) {
+        return RunUiBenchmark(benchmark_frames);
+    }
+    if (benchmark) {
+        if (benchmark_engines.empty()) {
+            benchmark_engines.assign(std::begin(chip8_engines), std::end(chip8_engines));
+        }
+        return RunBenchmark(benchmark_games, benchmark_engines, benchmark_cycles);
+    }
+
     std::random_device rd;
     std::mt19937 mt(rd());
     std::uniform_int_distribution<int> random(50, 255);
@@ -68,8 +146,8 @@ int main(int argc, char* args[]) {
         return 1;
     }
 
-    // Create renderer      SDL_RENDERER_SOFTWARE as a workaround for fixing the render clearing
-    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
+    // Create renderer
+    SDL_Renderer* renderer = CreateRenderer(window);
     if (renderer == nullptr)
     {
         std::cout << "Error in initializing rendering: " << SDL_GetError() << std::endl;
@@ -93,37 +171,59 @@ int main(int argc, char* args[]) {
         return 1;
     }
 
-    std::chrono::system_clock::time_point a = std::chrono::system_clock::now();
-    std::chrono::system_clock::time_point b = std::chrono::system_clock::now();
+    pacer.SetVsync(vsync);
+    int title_fps = -1;
     int draw_timer = 60;
+    // Display the texture holds and the color it was expanded with
+    uint64_t texture_rows[32] = {};
+    unsigned long long texture_frame = 0;
+    uint32_t texture_color = 0;
+    bool texture_rainbow = false;
+    // Set when the texture does not hold the display, the streaming texture starts out undefined
+    bool texture_lost = true;
+    // Frames still to draw while idle
+    int settle_frames = IDLE_SETTLE_FRAMES;
+
+    emulation.Start();
 
 	while (chip8.GetState() == State::ON)
 	{
         ImGuiIO& io = ImGui::GetIO();
 
-        // 60Hz
-        a = std::chrono::system_clock::now();
-        std::chrono::duration<double, std::milli> work_time = a - b;
-
-        if (work_time.count() < 200.0)
-        {
-            std::chrono::duration<double, std::milli> delta_ms((1000 / max_fps) - work_time.count());
-            auto delta_ms_duration = std::chrono::duration_cast<std::chrono::milliseconds>(delta_ms);
-            std::this_thread::sleep_for(std::chrono::milliseconds(delta_ms_duration.count()));
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+        if (vsync != pacer.GetVsync() && SDL_RenderSetVSync(renderer, vsync ? 1 : 0) == 0) {
+            pacer.SetVsync(vsync);
         }
+#endif
+        vsync = pacer.GetVsync();
+        pacer.SetTargetFps(max_fps);
 
-        b = std::chrono::system_clock::now();
-        std::chrono::duration<double, std::milli> sleep_time = b - a;
-        if (game_loaded && !game_paused) {
-            // Cycle
-            chip8.EmulateCycle(sound_timer);
-        }
+        // The emulation thread runs at 60Hz of emulated time on its own, whatever the FPS limit is
+        emulation.SetActive(game_loaded && !game_paused);
+        emulation.SetSound(sound_timer);
+        emulation.SetInstructionsPerFrame(instructions_per_frame);
 
         int wheel = 0;
 
         SDL_Event event;
+        bool has_event;
+        // Nothing on the screen moves on its own while no game runs, only an event or a new display changes it
+        const bool idle = idle_sleep && (!game_loaded || game_paused);
+        if (idle && settle_frames == 0) {
+            has_event = SDL_WaitEventTimeout(&event, IDLE_WAIT_MS) != 0;
+            pacer.Resume();
+        }
+        else {
+            pacer.Wait();
+            has_event = SDL_PollEvent(&event) != 0;
+        }
+        if (has_event) {
+            settle_frames = IDLE_SETTLE_FRAMES;
+        }
 
-        while (SDL_PollEvent(&event)) {
+        for (; has_event; has_event = SDL_PollEvent(&event) != 0) {
+            // SDL stamps the events in milliseconds since it started, move that to the steady clock
+            const std::chrono::steady_clock::time_point event_time = std::chrono::steady_clock::now() - std::chrono::milliseconds(SDL_GetTicks() - event.common.timestamp);
             switch (event.type)
             {
             case SDL_QUIT:
@@ -138,8 +238,9 @@ int main(int argc, char* args[]) {
                 }
                 for (int i = 0; i < 16; i++)
                 {
-                    if (event.key.keysym.sym == keymap[i]) {
-                        chip8.SetKey(i, true);
+                    // Auto repeat would restart the latency measurement of a held key
+                    if (event.key.keysym.sym == keymap[i] && event.key.repeat == 0) {
+                        emulation.GetKeys().Push(KeyEvent{ event_time, static_cast<uint8_t>(i), true });
                     }
                 }
                 break;
@@ -147,10 +248,15 @@ int main(int argc, char* args[]) {
                 for (int i = 0; i < 16; i++)
                 {
                     if (event.key.keysym.sym == keymap[i]) {
-                        chip8.SetKey(i, false);
+                        emulation.GetKeys().Push(KeyEvent{ event_time, static_cast<uint8_t>(i), false });
                     }
                 }
                 break;
+            case SDL_RENDER_TARGETS_RESET:
+            case SDL_RENDER_DEVICE_RESET:
+                ImGuiSDL::ClearCache();
+                texture_lost = true;
+                break;
             case SDL_WINDOWEVENT:
                 switch (event.window.event)
                 {
@@ -165,35 +271,90 @@ int main(int argc, char* args[]) {
                 break;
             }
         }
-        if (game_paused || !game_loaded) {
-            SDL_RenderClear(renderer);
+        // Rows that differ from the texture, frames the renderer skipped are covered as well
+        uint32_t dirty_rows = 0;
+        FrameBuffer& frame_buffer = emulation.GetFrames();
+        if (frame_buffer.Acquire()) {
+            const Frame& frame = frame_buffer.GetFront();
+            // A frame that matches the texture is on screen as well
+            texture_frame = frame.number;
+            for (int y = 0; y < 32; y++)
+            {
+                if (frame.rows[y] != texture_rows[y]) {
+                    dirty_rows |= 1u << y;
+                }
+            }
+        }
+        const uint32_t color = static_cast<uint32_t>(0xFFFFFFFF & pixel_color);
+        if (texture_lost || color != texture_color || rainbow_mode != texture_rainbow || (rainbow_mode && (dirty_rows != 0 || draw_timer == 0))) {
+            // The colors changed, every row has to be expanded again
+            dirty_rows = 0xFFFFFFFF;
+            texture_color = color;
+            texture_rainbow = rainbow_mode;
+            texture_lost = false;
         }
-        if (chip8.GetDrawFlag() || draw_timer == 0) {
-            chip8.SetDrawFlag(false);
-            draw_timer = 30;
-            uint32_t pixels[32 * 64];
-            for (int i = 0; i < 32 * 64; i++)
+        if (dirty_rows != 0) {
+            const Frame& frame = frame_buffer.GetFront();
+            std::copy(std::begin(frame.rows), std::end(frame.rows), std::begin(texture_rows));
+            // Upload each run of consecutive dirty rows, expanding the packed display straight into the texture
+            int y = 0;
+            while (y < 32)
             {
-                if (chip8.GetPixel(i) == 0)
-                {
-                    pixels[i] = 0xFF000000;
+                if ((dirty_rows & (1u << y)) == 0) {
+                    y++;
+                    continue;
                 }
-                else
+                int count = 1;
+                while (y + count < 32 && (dirty_rows & (1u << (y + count))) != 0)
                 {
-                    if (rainbow_mode) {
-                        pixel_color = createRGB(random(mt), random(mt), random(mt));
+                    count++;
+                }
+
+                const SDL_Rect rows = { 0, y, 64, count };
+                void* pixels;
+                int pitch;
+                if (SDL_LockTexture(texture, &rows, &pixels, &pitch) == 0) {
+                    for (int i = 0; i < count; i++)
+                    {
+                        uint32_t* line = reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(pixels) + i * pitch);
+                        const uint64_t row = texture_rows[y + i];
+                        if (rainbow_mode) {
+                            // Every lit pixel gets its own random color
+                            for (int x = 0; x < 64; x++)
+                            {
+                                line[x] = ((row >> (63 - x)) & 1) != 0 ? static_cast<uint32_t>(createRGB(random(mt), random(mt), random(mt))) : 0xFF000000;
+                            }
+                        }
+                        else {
+                            ExpandRow(row, line, color, 0xFF000000);
+                        }
                     }
-                    pixels[i] = (0xFFFFFFFF & pixel_color);
+                    SDL_UnlockTexture(texture);
                 }
+                y += count;
             }
-
-            SDL_UpdateTexture(texture, NULL, pixels, 64 * sizeof(uint32_t));
-            SDL_RenderCopy(renderer, texture, NULL, NULL);
         }
+        if (draw_timer == 0) {
+            draw_timer = 30;
+        }
+        if (idle) {
+            if (dirty_rows != 0) {
+                settle_frames = std::max(settle_frames, 1);
+            }
+            if (settle_frames == 0) {
+                continue;
+            }
+            settle_frames--;
+        }
+        // Every frame is composed from scratch, accelerated renderers do not keep the back buffer
+        // between presents and the UI must not leave anything behind when a menu closes
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0xFF);
+        SDL_RenderClear(renderer);
+        SDL_RenderCopy(renderer, texture, NULL, NULL);
         int mouseX, mouseY;
         const int buttons = SDL_GetMouseState(&mouseX, &mouseY);
 
-        io.DeltaTime = 1.0f / 60.0f;
+        io.DeltaTime = std::max(static_cast<float>(pacer.GetLastFrameTime()), 0.0001f);
         io.MousePos = ImVec2(static_cast<float>(mouseX), static_cast<float>(mouseY));
         io.MouseDown[0] = buttons & SDL_BUTTON(SDL_BUTTON_LEFT);
         io.MouseDown[1] = buttons & SDL_BUTTON(SDL_BUTTON_RIGHT);
@@ -204,19 +365,34 @@ int main(int argc, char* args[]) {
         if (imgui_visible) {
             ShowMenu();
             ShowInformation();
+            if (latency_visible) {
+                ShowLatency();
+            }
+            if (frame_times_visible) {
+                ShowFrameTimes();
+            }
         }
 
         ImGui::Render();
         ImGuiSDL::Render(ImGui::GetDrawData());
         SDL_RenderPresent(renderer);
+        emulation.GetLatency().FramePresented(texture_frame, std::chrono::steady_clock::now());
 
         if (draw_timer > 0) {
             draw_timer--;
         }
-        double frames = (work_time + sleep_time).count();
-        SDL_SetWindowTitle(window, ("Chip 8 emulator | FPS: " + std::string(std::to_string(1000 / frames)) + std::string(", Frames: ") + std::string(std::to_string(frames)) + std::string(" (ms)")).c_str());
+        // The pacer refreshes its FPS once per second
+        const FramePacerStats stats = pacer.GetStats();
+        if (static_cast<int>(stats.fps * 10) != title_fps) {
+            title_fps = static_cast<int>(stats.fps * 10);
+            char title[128];
+            snprintf(title, sizeof(title), "Chip 8 emulator | FPS: %.1f, Frame: %.2f ms (p99 %.2f ms)", stats.fps, stats.average, stats.p99);
+            SDL_SetWindowTitle(window, title);
+        }
 	}
 
+    emulation.Stop();
+
     ImGuiSDL::Deinitialize();
 
     SDL_DestroyRenderer(renderer);
@@ -237,16 +413,98 @@ void ShowInformation() {
         ImGui::Text("q  w  e  r");
         ImGui::Text("a  s  d  f");
         ImGui::Text("z  x  c  v");
+        ImGui::Text("Renderer: %s", renderer_name.c_str());
+    }
+    ImGui::End();
+}
+
+void ShowLatency() {
+    if (ImGui::Begin("Latency", &latency_visible)) {
+        LatencyTracker& latency = emulation.GetLatency();
+        LatencyPercentiles percentiles[4];
+        latency.GetPercentiles(percentiles);
+        const char* stages[] = { "SetKey", "Key read", "Display change", "Present" };
+
+        ImGui::Text("Key presses: %d (ms since the key event)", static_cast<int>(latency.GetSampleCount()));
+        ImGui::Columns(4);
+        ImGui::Text("Stage");
+        ImGui::NextColumn();
+        ImGui::Text("p50");
+        ImGui::NextColumn();
+        ImGui::Text("p95");
+        ImGui::NextColumn();
+        ImGui::Text("p99");
+        ImGui::NextColumn();
+        for (int i = 0; i < 4; i++)
+        {
+            ImGui::Text("%s", stages[i]);
+            ImGui::NextColumn();
+            ImGui::Text("%.2f", percentiles[i].p50);
+            ImGui::NextColumn();
+            ImGui::Text("%.2f", percentiles[i].p95);
+            ImGui::NextColumn();
+            ImGui::Text("%.2f", percentiles[i].p99);
+            ImGui::NextColumn();
+        }
+        ImGui::Columns(1);
+
+        if (ImGui::Button("Save CSV")) {
+            if (latency.WriteCsv("latency.csv")) {
+                std::cout << "Saved latency.csv" << std::endl;
+            }
+            else {
+                std::cout << "Failed to save latency.csv" << std::endl;
+            }
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Clear")) {
+            latency.Clear();
+        }
+    }
+    ImGui::End();
+}
+
+void ShowFrameTimes() {
+    if (ImGui::Begin("Frame times", &frame_times_visible)) {
+        const FramePacerStats stats = pacer.GetStats();
+        ImGui::Text("Target: %d fps%s", max_fps, pacer.GetVsync() ? " (vsync)" : "");
+        ImGui::Text("FPS: %.1f over %lld frames", stats.fps, stats.frames);
+        ImGui::Text("Average %.2f ms, min %.2f ms, max %.2f ms", stats.average, stats.minimum, stats.maximum);
+        ImGui::Text("p50 %.2f ms, p99 %.2f ms", stats.p50, stats.p99);
+
+        // Up to 50ms in buckets of FramePacer::BUCKET_WIDTH
+        float histogram[FramePacer::HISTOGRAM_BUCKETS];
+        const long long* buckets = pacer.GetHistogram();
+        for (int i = 0; i < FramePacer::HISTOGRAM_BUCKETS; i++)
+        {
+            histogram[i] = static_cast<float>(buckets[i]);
+        }
+        ImGui::PlotHistogram("##frame_times", histogram, FramePacer::HISTOGRAM_BUCKETS, 0, "0 - 50 ms", 0.0f, FLT_MAX, ImVec2(400, 120));
+
+        // Only used by the software UI rendering
+        ImGuiSDL::CacheStats uniform_color, generic;
+        ImGuiSDL::GetCacheStats(uniform_color, generic);
+        ImGui::Text("UI triangle caches (entries, hits, misses, evictions)");
+        ImGui::Text("Uniform color: %d/%d, %llu, %llu, %llu", uniform_color.Entries, uniform_color.Capacity, uniform_color.Hits, uniform_color.Misses, uniform_color.Evictions);
+        ImGui::Text("Generic: %d/%d, %llu, %llu, %llu", generic.Entries, generic.Capacity, generic.Hits, generic.Misses, generic.Evictions);
+        ImGuiSDL::TexturePoolStats pool;
+        ImGuiSDL::GetTexturePoolStats(pool);
+        ImGui::Text("Texture pool: %d waiting (%lld KB), %llu created, %llu reused", pool.Textures, pool.Pixels * 4 / 1024, pool.Created, pool.Reused);
+
+        if (ImGui::Button("Reset")) {
+            pacer.ResetStats();
+        }
     }
     ImGui::End();
 }
 
-static void ShowMenu()
+void ShowMenu()
 {
     if (ImGui::BeginMainMenuBar()) {
         if (ImGui::BeginMenu("Menu")) {
             if (ImGui::MenuItem("Open")) {
                 if (SelectGame()) {
+                    std::unique_lock<std::mutex> lock = emulation.Lock();
                     if (game_loaded) {
                         chip8.Reset();
                     }
@@ -268,11 +526,13 @@ static void ShowMenu()
             }
             
             if (ImGui::MenuItem("Reset", "", false, game_loaded)) {
+                std::unique_lock<std::mutex> lock = emulation.Lock();
                 chip8.Reset();
                 chip8.LoadGame(current_game);
             }
 
             if (ImGui::MenuItem("Stop", "", false, game_loaded)) {
+                std::unique_lock<std::mutex> lock = emulation.Lock();
                 chip8.Reset();
                 game_loaded = false;
                 game_paused = false;
@@ -290,10 +550,20 @@ static void ShowMenu()
         if (ImGui::BeginMenu("Settings"))
         {
             ImGui::Checkbox("Enable the sound timer \"Beep\"", &sound_timer);
+            ImGui::Checkbox("Show input latency", &latency_visible);
+            ImGui::Checkbox("Show frame times", &frame_times_visible);
+            ImGui::Checkbox("Sleep while paused or stopped", &idle_sleep);
+            bool batched_ui = ImGuiSDL::IsGeometryEnabled();
+            if (ImGui::Checkbox("Batched UI rendering (SDL 2.0.18+)", &batched_ui)) {
+                ImGuiSDL::SetGeometryEnabled(batched_ui);
+            }
             if (ImGui::BeginMenu("FPS limit")) {
                 const char* items[] = { "15 fps", "30 fps", "60 fps", "120 fps", "144 fps", "360 fps", "720 fps"};
                 static int item_current = 2;
                 ImGui::Combo("Max", &item_current, items, IM_ARRAYSIZE(items));
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+                ImGui::Checkbox("VSync", &vsync);
+#endif
                 switch (item_current)
                 {
                 case 0:
@@ -324,6 +594,32 @@ static void ShowMenu()
                 ImGui::EndMenu();
             }
 
+            if (ImGui::BeginMenu("CPU engine")) {
+                for (const Engine &engine : chip8_engines)
+                {
+                    if (ImGui::MenuItem(GetEngineName(engine).c_str(), "", chip8.GetEngine() == engine)) {
+                        std::unique_lock<std::mutex> lock = emulation.Lock();
+                        chip8.SetEngine(engine);
+                    }
+                }
+                if (chip8.GetEngine() == Engine::JIT) {
+                    std::unique_lock<std::mutex> lock = emulation.Lock();
+                    if (!chip8.IsJitAvailable()) {
+                        ImGui::TextDisabled("No executable memory, the JIT runs the cached engine");
+                    }
+                }
+                ImGui::EndMenu();
+            }
+
+            if (ImGui::BeginMenu("CPU speed")) {
+                const char* items[] = { "1", "10", "20", "50", "100", "500", "1000", "2000" };
+                const int speeds[] = { 1, 10, 20, 50, 100, 500, 1000, 2000 };
+                static int item_current = 1;
+                ImGui::Combo("Instructions per frame", &item_current, items, IM_ARRAYSIZE(items));
+                instructions_per_frame = speeds[item_current];
+                ImGui::EndMenu();
+            }
+
             if (ImGui::BeginMenu("Pixel color"))
             {   
                 ImGui::Checkbox("Colorful mode", &rainbow_mode);
@@ -356,6 +652,32 @@ unsigned long createRGB(int r, int g, int b, int a) {
     return (a << 24) + ((r & 0xff) << 16) + ((g & 0xff) << 8) + ((b & 0xff));
 }
 
+SDL_Renderer* CreateRenderer(SDL_Window* window) {
+    const Uint32 present = vsync ? SDL_RENDERER_PRESENTVSYNC : 0;
+    SDL_Renderer* renderer = nullptr;
+
+    // Renderers without target textures are left to the software one, which always has them
+    if (renderer_type != "software") {
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE | present);
+        if (renderer == nullptr) {
+            std::cout << "Accelerated renderer not available: " << SDL_GetError() << std::endl;
+            if (renderer_type == "accelerated") {
+                return nullptr;
+            }
+        }
+    }
+    if (renderer == nullptr) {
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE | present);
+    }
+
+    SDL_RendererInfo info;
+    if (renderer != nullptr && SDL_GetRendererInfo(renderer, &info) == 0) {
+        renderer_name = info.name;
+        std::cout << "Renderer: " << renderer_name << std::endl;
+    }
+    return renderer;
+}
+
 bool SelectGame() {
     nfdchar_t* outPath = NULL;
     nfdresult_t result = NFD_OpenDialog(NULL, NULL, &outPath);
@@ -4,16 +4,29 @@
 
 #include "imgui.h"
 
+// imgui_draw.cpp keeps its rectangle packer to itself.
+#define STBRP_STATIC
+#define STBRP_ASSERT(x) assert(x)
+#define STB_RECT_PACK_IMPLEMENTATION
+#include "imstb_rectpack.h"
+
 #include <map>
-#include <list>
 #include <cmath>
+#include <cstring>
 #include <array>
 #include <vector>
 #include <memory>
 #include <iostream>
 #include <algorithm>
 #include <functional>
-#include <unordered_map>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define IMGUI_SDL_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IMGUI_SDL_SSE2
+#endif
 
 namespace
 {
@@ -62,51 +75,133 @@ namespace
 		};
 	}
 
+	// Holds up to Size values without allocating. The keys are found through an open addressed table with linear probing that has
+	// at least twice as many buckets as entries, and the entries form a doubly linked list of indices from the most to the least
+	// recently used one. A full cache reuses the entry of the least recently used value. Value has to be default constructible
+	// and move assignable, assigning a default value to an entry frees what the old one held.
 	template <typename Key, typename Value, std::size_t Size> class LRUCache
 	{
 	public:
-		bool Contains(const Key& key) const
-		{
-			return Container.find(key) != Container.end();
-		}
+		LRUCache() { Clear(); }
 
-		const Value& At(const Key& key)
+		// The value of the key, which becomes the most recently used one, or null if the key is not cached.
+		Value* Find(const Key& key)
 		{
-			assert(Contains(key));
+			const std::size_t hash = TupleHash::Hash<Key>()(key);
+			const Index entry = Table[Locate(key, hash)];
+			if (entry == None)
+			{
+				Misses++;
+				return nullptr;
+			}
 
-			const auto location = Container.find(key);
-			Order.splice(Order.begin(), Order, location->second);
-			return location->second->second;
+			Hits++;
+			Unlink(entry);
+			PushFront(entry);
+			return &Values[entry];
 		}
 
-		void Insert(const Key& key, Value value)
+		// Adds the key as the most recently used one and returns its empty value to be filled in. The key must not be cached yet.
+		Value& Insert(const Key& key)
 		{
-			const auto existingLocation = Container.find(key);
-			if (existingLocation != Container.end())
+			const std::size_t hash = TupleHash::Hash<Key>()(key);
+
+			Index entry;
+			if (Count < Size)
+			{
+				entry = static_cast<Index>(Count++);
+			}
+			else
 			{
-				Order.erase(existingLocation->second);
-				Container.erase(existingLocation);
+				entry = Tail;
+				Evictions++;
+				Unlink(entry);
+				Erase(Locate(Keys[entry], Hashes[entry]));
+				Values[entry] = Value();
 			}
 
-			Order.push_front(std::make_pair(key, std::move(value)));
-			Container.insert(std::make_pair(key, Order.begin()));
+			const std::size_t bucket = Locate(key, hash);
+			assert(Table[bucket] == None);
+			Table[bucket] = entry;
+			Keys[entry] = key;
+			Hashes[entry] = hash;
+			PushFront(entry);
+			return Values[entry];
+		}
 
-			Clean();
+		void Clear()
+		{
+			for (std::size_t i = 0; i < Count; i++) Values[i] = Value();
+			Table.fill(None);
+			Count = 0;
+			Head = Tail = None;
 		}
+
+		std::size_t GetCount() const { return Count; }
+		static constexpr std::size_t GetCapacity() { return Size; }
+
+		// Counted since the cache was created, Clear keeps them.
+		unsigned long long Hits = 0, Misses = 0, Evictions = 0;
 	private:
-		void Clean()
+		using Index = uint32_t;
+		static constexpr Index None = ~Index(0);
+
+		static constexpr std::size_t BucketCount(std::size_t count = 1) { return count >= 2 * Size ? count : BucketCount(count * 2); }
+		static constexpr std::size_t Buckets = BucketCount();
+
+		// The bucket that holds the key, or the empty one that ends its probe sequence.
+		std::size_t Locate(const Key& key, std::size_t hash) const
+		{
+			std::size_t bucket = hash & (Buckets - 1);
+			while (Table[bucket] != None && (Hashes[Table[bucket]] != hash || !(Keys[Table[bucket]] == key)))
+			{
+				bucket = (bucket + 1) & (Buckets - 1);
+			}
+			return bucket;
+		}
+
+		// Empties the bucket and moves the following entries of the cluster back, so no probe sequence ends early.
+		void Erase(std::size_t bucket)
 		{
-			while (Container.size() > Size)
+			std::size_t next = bucket;
+			for (;;)
 			{
-				auto last = Order.end();
-				last--;
-				Container.erase(last->first);
-				Order.pop_back();
+				next = (next + 1) & (Buckets - 1);
+				if (Table[next] == None) break;
+
+				// The entry can move back when the emptied bucket is not before its home bucket.
+				const std::size_t home = Hashes[Table[next]] & (Buckets - 1);
+				if (((next - home) & (Buckets - 1)) >= ((next - bucket) & (Buckets - 1)))
+				{
+					Table[bucket] = Table[next];
+					bucket = next;
+				}
 			}
+			Table[bucket] = None;
 		}
 
-		std::list<std::pair<Key, Value>> Order;
-		std::unordered_map<Key, decltype(Order.begin()), TupleHash::Hash<Key>> Container;
+		void Unlink(Index entry)
+		{
+			if (Previous[entry] != None) Next[Previous[entry]] = Next[entry]; else Head = Next[entry];
+			if (Next[entry] != None) Previous[Next[entry]] = Previous[entry]; else Tail = Previous[entry];
+		}
+
+		void PushFront(Index entry)
+		{
+			Previous[entry] = None;
+			Next[entry] = Head;
+			if (Head != None) Previous[Head] = entry; else Tail = entry;
+			Head = entry;
+		}
+
+		std::array<Index, Buckets> Table;
+
+		std::array<Key, Size> Keys;
+		std::array<std::size_t, Size> Hashes;
+		std::array<Value, Size> Values;
+		std::array<Index, Size> Previous, Next;
+		std::size_t Count = 0;
+		Index Head = None, Tail = None;
 	};
 
 	struct Color
@@ -139,23 +234,328 @@ namespace
 		}
 	};
 
+	// Textures for the triangles that do not fit into the atlas. Their sizes are rounded up to powers of two, so a texture given
+	// back when its triangle is evicted can hold the next triangle of a similar size instead of going back to the driver.
+	struct TexturePool
+	{
+		static constexpr int MinSize = 32;
+		// Larger textures given back while the pool holds this many pixels are destroyed.
+		static constexpr long long MaxPixels = 4 * 1024 * 1024;
+
+		SDL_Renderer* Renderer;
+
+		// Textures waiting in the pool and the pixels they hold.
+		int Textures = 0;
+		long long Pixels = 0;
+		unsigned long long Created = 0, Reused = 0;
+
+		TexturePool(SDL_Renderer* renderer) : Renderer(renderer) { }
+		~TexturePool() { Clear(); }
+
+		// A texture at least as large as asked for, the pixels outside of that are left over from earlier use.
+		SDL_Texture* Acquire(int width, int height)
+		{
+			std::vector<SDL_Texture*>& bucket = Buckets[std::make_pair(BucketSize(width), BucketSize(height))];
+			if (!bucket.empty())
+			{
+				SDL_Texture* texture = bucket.back();
+				bucket.pop_back();
+				Textures--;
+				Pixels -= static_cast<long long>(BucketSize(width)) * BucketSize(height);
+				Reused++;
+				return texture;
+			}
+
+			SDL_Texture* texture = SDL_CreateTexture(Renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC, BucketSize(width), BucketSize(height));
+			if (!texture) return nullptr;
+			SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+			Created++;
+			return texture;
+		}
+
+		void Recycle(SDL_Texture* texture)
+		{
+			int width, height;
+			SDL_QueryTexture(texture, nullptr, nullptr, &width, &height);
+
+			const long long size = static_cast<long long>(width) * height;
+			if (Pixels + size > MaxPixels)
+			{
+				SDL_DestroyTexture(texture);
+				return;
+			}
+
+			Buckets[std::make_pair(width, height)].push_back(texture);
+			Textures++;
+			Pixels += size;
+		}
+
+		void Clear()
+		{
+			for (auto& bucket : Buckets)
+			{
+				for (SDL_Texture* texture : bucket.second) SDL_DestroyTexture(texture);
+			}
+			Buckets.clear();
+			Textures = 0;
+			Pixels = 0;
+		}
+	private:
+		static int BucketSize(int size)
+		{
+			int bucket = MinSize;
+			while (bucket < size) bucket *= 2;
+			return bucket;
+		}
+
+		std::map<std::pair<int, int>, std::vector<SDL_Texture*>> Buckets;
+	};
+
+	// Pages of texture space for the cached triangles. A page is packed with stb_rect_pack, which cannot free single rectangles,
+	// so it counts the triangles that still use it and starts over when none are left. When no page has room the one with the
+	// fewest triangles starts over early, the generation tells its triangles that their pixels are gone.
+	struct TriangleAtlas
+	{
+		static constexpr int PageSize = 1024;
+		static constexpr int MaxPages = 4;
+		// Larger triangles get a texture of their own.
+		static constexpr int MaxRegionSize = PageSize / 4;
+		// Transparent pixels around every triangle, so scaled copies never pick up the neighbors.
+		static constexpr int Border = 1;
+
+		struct Region
+		{
+			int Page = -1;
+			unsigned int Generation = 0;
+			int X = 0, Y = 0;
+		};
+
+		SDL_Renderer* Renderer;
+
+		TriangleAtlas(SDL_Renderer* renderer) : Renderer(renderer) { }
+		~TriangleAtlas() { Clear(); }
+
+		// Finds room for a region of the size, false when it is too large for the pages or no page can be made.
+		bool Allocate(int width, int height, Region& region)
+		{
+			if (width > MaxRegionSize || height > MaxRegionSize) return false;
+
+			for (int page = 0; page < PageCount; page++)
+			{
+				if (Pack(page, width, height, region)) return true;
+			}
+
+			int page;
+			if (PageCount < MaxPages)
+			{
+				SDL_Texture* texture = SDL_CreateTexture(Renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC, PageSize, PageSize);
+				if (!texture) return false;
+				SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+
+				page = PageCount++;
+				Pages[page].Texture = texture;
+			}
+			else
+			{
+				page = static_cast<int>(std::min_element(Pages.begin(), Pages.end(), [](const Page& a, const Page& b) { return a.Used < b.Used; }) - Pages.begin());
+			}
+
+			Restart(page);
+			return Pack(page, width, height, region);
+		}
+
+		void Release(const Region& region)
+		{
+			if (!Contains(region)) return;
+
+			if (--Pages[region.Page].Used == 0) Restart(region.Page);
+		}
+
+		// The pixels of the region are still in its page.
+		bool Contains(const Region& region) const
+		{
+			return region.Page >= 0 && region.Page < PageCount && Pages[region.Page].Generation == region.Generation;
+		}
+
+		SDL_Texture* GetTexture(const Region& region) const { return Pages[region.Page].Texture; }
+
+		// Destroys the pages, every region becomes stale.
+		void Clear()
+		{
+			for (int page = 0; page < PageCount; page++)
+			{
+				SDL_DestroyTexture(Pages[page].Texture);
+				Pages[page].Texture = nullptr;
+				Pages[page].Used = 0;
+				Pages[page].Generation++;
+			}
+			PageCount = 0;
+		}
+	private:
+		struct Page
+		{
+			SDL_Texture* Texture = nullptr;
+			stbrp_context Context;
+			std::array<stbrp_node, PageSize> Nodes;
+			// Regions handed out since the page started over and not released yet.
+			int Used = 0;
+			unsigned int Generation = 0;
+		};
+
+		bool Pack(int page, int width, int height, Region& region)
+		{
+			stbrp_rect rect = { };
+			rect.w = static_cast<stbrp_coord>(width);
+			rect.h = static_cast<stbrp_coord>(height);
+			stbrp_pack_rects(&Pages[page].Context, &rect, 1);
+			if (!rect.was_packed) return false;
+
+			region.Page = page;
+			region.Generation = Pages[page].Generation;
+			region.X = rect.x;
+			region.Y = rect.y;
+			Pages[page].Used++;
+			return true;
+		}
+
+		void Restart(int page)
+		{
+			stbrp_init_target(&Pages[page].Context, PageSize, PageSize, Pages[page].Nodes.data(), PageSize);
+			Pages[page].Used = 0;
+			Pages[page].Generation++;
+		}
+
+		std::array<Page, MaxPages> Pages;
+		int PageCount = 0;
+	};
+
+	// The UI as it was drawn last time, copied to the screen again while the draw data stays the same. Drawing with alpha blending
+	// onto the transparent layer leaves the colors multiplied by their alpha, so the layer is copied with a premultiplied alpha
+	// blend mode. A renderer without custom blend modes (the software one) draws the UI straight to the screen every time.
+	struct UILayer
+	{
+		SDL_Renderer* Renderer;
+		SDL_Texture* Texture = nullptr;
+		int Width = 0, Height = 0;
+
+		bool Supported = true;
+		// The texture holds the UI of the draw data with this fingerprint.
+		bool Valid = false;
+		uint64_t Fingerprint = 0;
+
+		UILayer(SDL_Renderer* renderer) : Renderer(renderer) { }
+		~UILayer() { Clear(); }
+
+		// Makes a layer of the size, false when the UI has to be drawn straight to the screen.
+		bool Prepare(int width, int height)
+		{
+			if (!Supported || width <= 0 || height <= 0) return false;
+			if (Texture && width == Width && height == Height) return true;
+
+			Clear();
+#if SDL_VERSION_ATLEAST(2, 0, 6)
+			// Creating the texture can fail for a while (low memory, a lost device), the next frame tries again.
+			Texture = SDL_CreateTexture(Renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_TARGET, width, height);
+			if (!Texture) return false;
+
+			const SDL_BlendMode premultiplied = SDL_ComposeCustomBlendMode(
+				SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD,
+				SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD);
+			if (SDL_SetTextureBlendMode(Texture, premultiplied) == 0)
+			{
+				Width = width;
+				Height = height;
+				return true;
+			}
+#endif
+			// The renderer cannot blend the layer, it never will.
+			Clear();
+			Supported = false;
+			return false;
+		}
+
+		void Clear()
+		{
+			if (Texture) SDL_DestroyTexture(Texture);
+			Texture = nullptr;
+			Valid = false;
+		}
+	};
+
 	struct Device
 	{
 		SDL_Renderer* Renderer;
 
+		// SDL_RenderGeometry is available at compile and at run time, and the batches are wanted.
+		bool GeometrySupported = false;
+		bool UseGeometry = false;
+
 		struct ClipRect
 		{
 			int X, Y, Width, Height;
 		} Clip;
 
+		// The pixels of a triangle are in a region of the atlas, or in a texture of the pool when they do not fit into it. An empty
+		// triangle has neither. Either way they have the atlas border around them.
 		struct TriangleCacheItem
 		{
+			TriangleAtlas* Atlas = nullptr;
+			TriangleAtlas::Region Region;
+			TexturePool* Pool = nullptr;
 			SDL_Texture* Texture = nullptr;
 			int Width = 0, Height = 0;
 
-			~TriangleCacheItem() { if (Texture) SDL_DestroyTexture(Texture); }
+			TriangleCacheItem() = default;
+			TriangleCacheItem(const TriangleCacheItem&) = delete;
+			TriangleCacheItem& operator=(const TriangleCacheItem&) = delete;
+			TriangleCacheItem& operator=(TriangleCacheItem&& other)
+			{
+				if (this != &other)
+				{
+					Release();
+					Atlas = other.Atlas;
+					Region = other.Region;
+					Pool = other.Pool;
+					Texture = other.Texture;
+					Width = other.Width;
+					Height = other.Height;
+					other.Atlas = nullptr;
+					other.Texture = nullptr;
+				}
+				return *this;
+			}
+			~TriangleCacheItem() { Release(); }
+
+			// The atlas page the pixels were in has started over since, the triangle has to be rasterized again.
+			bool IsStale() const { return Atlas && !Atlas->Contains(Region); }
+
+			// The texture and the area of it that hold the pixels, null for an empty triangle.
+			SDL_Texture* GetSource(SDL_Rect& source) const
+			{
+				if (Atlas)
+				{
+					source = { Region.X + TriangleAtlas::Border, Region.Y + TriangleAtlas::Border, Width, Height };
+					return Atlas->GetTexture(Region);
+				}
+				source = { TriangleAtlas::Border, TriangleAtlas::Border, Width, Height };
+				return Texture;
+			}
+
+			void Release()
+			{
+				if (Atlas) Atlas->Release(Region);
+				if (Texture) Pool->Recycle(Texture);
+				Atlas = nullptr;
+				Texture = nullptr;
+			}
 		};
 
+		// Declared before the caches, which give their regions and textures back to them when they are destroyed.
+		TexturePool Pool;
+		TriangleAtlas Atlas;
+
+		UILayer Layer;
+
 		// You can tweak these to values that you find that work the best.
 		static constexpr std::size_t UniformColorTriangleCacheSize = 512;
 		static constexpr std::size_t GenericTriangleCacheSize = 64;
@@ -167,10 +567,10 @@ namespace
 		using GenericTriangleVertexKey = std::tuple<int, int, double, double, uint32_t>;
 		using GenericTriangleKey = std::tuple<GenericTriangleVertexKey, GenericTriangleVertexKey, GenericTriangleVertexKey>;
 
-		LRUCache<UniformColorTriangleKey, std::unique_ptr<TriangleCacheItem>, UniformColorTriangleCacheSize> UniformColorTriangleCache;
-		LRUCache<GenericTriangleKey, std::unique_ptr<TriangleCacheItem>, GenericTriangleCacheSize> GenericTriangleCache;
+		LRUCache<UniformColorTriangleKey, TriangleCacheItem, UniformColorTriangleCacheSize> UniformColorTriangleCache;
+		LRUCache<GenericTriangleKey, TriangleCacheItem, GenericTriangleCacheSize> GenericTriangleCache;
 
-		Device(SDL_Renderer* renderer) : Renderer(renderer) { }
+		Device(SDL_Renderer* renderer) : Renderer(renderer), Pool(renderer), Atlas(renderer), Layer(renderer) { }
 
 		void SetClipRect(const ClipRect& rect)
 		{
@@ -179,29 +579,31 @@ namespace
 			SDL_RenderSetClipRect(Renderer, &clip);
 		}
 
-		void EnableClip() { SetClipRect(Clip); }
 		void DisableClip() { SDL_RenderSetClipRect(Renderer, nullptr); }
 
-		void SetAt(int x, int y, const Color& color)
-		{
-			color.UseAsDrawColor(Renderer);
-			SDL_RenderDrawPoint(Renderer, x, y);
-		}
+		// Scratch buffer the triangles are rasterized into before they are uploaded, kept to avoid an allocation per triangle.
+		std::vector<uint32_t> Pixels;
 
-		SDL_Texture* MakeTexture(int width, int height)
+		// Uploads the rasterized pixels of a triangle, which have the atlas border around them, into the atlas or a texture of the pool.
+		void Store(TriangleCacheItem& item, const std::vector<uint32_t>& pixels, int width, int height)
 		{
-			SDL_Texture* texture = SDL_CreateTexture(Renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_TARGET, width, height);
-			SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
-			return texture;
-		}
+			const int border = TriangleAtlas::Border;
+			const int pitch = (width + 2 * border) * static_cast<int>(sizeof(uint32_t));
 
-		void UseAsRenderTarget(SDL_Texture* texture)
-		{
-			SDL_SetRenderTarget(Renderer, texture);
-			if (texture)
+			item.Width = width;
+			item.Height = height;
+			SDL_Rect area = { 0, 0, width + 2 * border, height + 2 * border };
+			if (Atlas.Allocate(area.w, area.h, item.Region))
 			{
-				SDL_SetRenderDrawColor(Renderer, 0, 0, 0, 0);
-				SDL_RenderClear(Renderer);
+				item.Atlas = &Atlas;
+				area.x = item.Region.X;
+				area.y = item.Region.Y;
+				SDL_UpdateTexture(Atlas.GetTexture(item.Region), &area, pixels.data(), pitch);
+			}
+			else if ((item.Texture = Pool.Acquire(area.w, area.h)) != nullptr)
+			{
+				item.Pool = &Pool;
+				SDL_UpdateTexture(item.Texture, &area, pixels.data(), pitch);
 			}
 		}
 	};
@@ -217,43 +619,37 @@ namespace
 			SDL_DestroyTexture(Source);
 		}
 
-		Color Sample(float u, float v) const
+		// Texel in the row and column given in 16.16 fixed point, clamped to the texture.
+		uint32_t At(int u, int v) const
 		{
-			const int x = static_cast<int>(std::round(u * (Surface->w - 1) + 0.5f));
-			const int y = static_cast<int>(std::round(v * (Surface->h - 1) + 0.5f));
-
-			const int location = y * Surface->w + x;
-			assert(location < Surface->w * Surface->h);
+			const int x = std::min(std::max(u >> 16, 0), Surface->w - 1);
+			const int y = std::min(std::max(v >> 16, 0), Surface->h - 1);
 
-			return Color(static_cast<uint32_t*>(Surface->pixels)[location]);
+			return static_cast<const uint32_t*>(Surface->pixels)[y * Surface->w + x];
 		}
 	};
 
-	template <typename T> class InterpolatedFactorEquation
+	// A value interpolated between the vertices of a triangle, written as the plane value = DX * x + DY * y + C. The divisor
+	// of the barycentric weights is inverted once per triangle, a pixel then costs a multiply and an add, and moving one pixel
+	// to the right adds DX.
+	struct LinearEquation
 	{
-	public:
-		InterpolatedFactorEquation(const T& value0, const T& value1, const T& value2, const ImVec2& v0, const ImVec2& v1, const ImVec2& v2)
-			: Value0(value0), Value1(value1), Value2(value2), V0(v0), V1(v1), V2(v2),
-			Divisor((V1.y - V2.y) * (V0.x - V2.x) + (V2.x - V1.x) * (V0.y - V2.y)) { }
+		float DX, DY, C;
 
-		T Evaluate(float x, float y) const
+		LinearEquation(float value0, float value1, float value2, const ImVec2& v0, const ImVec2& v1, const ImVec2& v2)
 		{
-			const float w1 = ((V1.y - V2.y) * (x - V2.x) + (V2.x - V1.x) * (y - V2.y)) / Divisor;
-			const float w2 = ((V2.y - V0.y) * (x - V2.x) + (V0.x - V2.x) * (y - V2.y)) / Divisor;
-			const float w3 = 1.0f - w1 - w2;
-
-			return static_cast<T>((Value0 * w1) + (Value1 * w2) + (Value2 * w3));
+			const float divisor = (v1.y - v2.y) * (v0.x - v2.x) + (v2.x - v1.x) * (v0.y - v2.y);
+			// A degenerate triangle covers no pixels.
+			const float inverse = divisor != 0.0f ? 1.0f / divisor : 0.0f;
+
+			const float delta0 = value0 - value2;
+			const float delta1 = value1 - value2;
+			DX = (delta0 * (v1.y - v2.y) + delta1 * (v2.y - v0.y)) * inverse;
+			DY = (delta0 * (v2.x - v1.x) + delta1 * (v0.x - v2.x)) * inverse;
+			C = value2 - DX * v2.x - DY * v2.y;
 		}
-	private:
-		const T Value0;
-		const T Value1;
-		const T Value2;
 
-		const ImVec2& V0;
-		const ImVec2& V1;
-		const ImVec2& V2;
-
-		const float Divisor;
+		float Evaluate(float x, float y) const { return DX * x + DY * y + C; }
 	};
 
 	struct Rect
@@ -266,6 +662,12 @@ namespace
 			return (point.x == MinX || point.x == MaxX) && (point.y == MinY || point.y == MaxY);
 		}
 
+		// No pixel center inside of the box is also inside of the clip rect.
+		bool IsOutside(const Device::ClipRect& clip) const
+		{
+			return MaxX <= clip.X || MinX >= clip.X + clip.Width || MaxY <= clip.Y || MinY >= clip.Y + clip.Height;
+		}
+
 		bool UsesOnlyColor() const
 		{
 			const ImVec2& whitePixel = ImGui::GetIO().Fonts->TexUvWhitePixel;
@@ -314,7 +716,83 @@ namespace
 		}
 	};
 
-	void DrawTriangleWithColorFunction(const FixedPointTriangleRenderInfo& renderInfo, const std::function<Color(float x, float y)>& colorFunction, Device::TriangleCacheItem* cacheItem)
+	// Tests the three edge functions for 8 horizontally adjacent pixels at once. Uses AVX2 or SSE2 when the compiler targets them,
+	// otherwise plain C++.
+	class CoverageTester
+	{
+	public:
+		// The steps are how much each edge function decreases from one pixel to the next one on the right.
+		CoverageTester(int step1, int step2, int step3)
+		{
+#if defined(IMGUI_SDL_AVX2)
+			const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+			Steps1 = _mm256_mullo_epi32(lanes, _mm256_set1_epi32(step1));
+			Steps2 = _mm256_mullo_epi32(lanes, _mm256_set1_epi32(step2));
+			Steps3 = _mm256_mullo_epi32(lanes, _mm256_set1_epi32(step3));
+#elif defined(IMGUI_SDL_SSE2)
+			// SSE2 has no 32 bit multiply, so the offsets of the two groups of 4 pixels are built up front.
+			Steps1 = _mm_setr_epi32(0, step1, step1 * 2, step1 * 3);
+			Steps2 = _mm_setr_epi32(0, step2, step2 * 2, step2 * 3);
+			Steps3 = _mm_setr_epi32(0, step3, step3 * 2, step3 * 3);
+			Step1 = step1 * 4;
+			Step2 = step2 * 4;
+			Step3 = step3 * 4;
+#else
+			Step1 = step1;
+			Step2 = step2;
+			Step3 = step3;
+#endif
+		}
+
+		// Bit i is set when the pixel i to the right of the one with the given edge values lies inside all three edges.
+		uint32_t Test(int edge1, int edge2, int edge3) const
+		{
+#if defined(IMGUI_SDL_AVX2)
+			const __m256i zero = _mm256_setzero_si256();
+			const __m256i inside1 = _mm256_cmpgt_epi32(_mm256_sub_epi32(_mm256_set1_epi32(edge1), Steps1), zero);
+			const __m256i inside2 = _mm256_cmpgt_epi32(_mm256_sub_epi32(_mm256_set1_epi32(edge2), Steps2), zero);
+			const __m256i inside3 = _mm256_cmpgt_epi32(_mm256_sub_epi32(_mm256_set1_epi32(edge3), Steps3), zero);
+			const __m256i inside = _mm256_and_si256(_mm256_and_si256(inside1, inside2), inside3);
+			return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(inside)));
+#elif defined(IMGUI_SDL_SSE2)
+			return Test4(edge1, edge2, edge3) | (Test4(edge1 - Step1, edge2 - Step2, edge3 - Step3) << 4);
+#else
+			uint32_t mask = 0;
+			for (int i = 0; i < 8; i++)
+			{
+				if (edge1 > 0 && edge2 > 0 && edge3 > 0) mask |= 1u << i;
+
+				edge1 -= Step1;
+				edge2 -= Step2;
+				edge3 -= Step3;
+			}
+			return mask;
+#endif
+		}
+	private:
+#if defined(IMGUI_SDL_AVX2)
+		__m256i Steps1, Steps2, Steps3;
+#elif defined(IMGUI_SDL_SSE2)
+		uint32_t Test4(int edge1, int edge2, int edge3) const
+		{
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i inside1 = _mm_cmpgt_epi32(_mm_sub_epi32(_mm_set1_epi32(edge1), Steps1), zero);
+			const __m128i inside2 = _mm_cmpgt_epi32(_mm_sub_epi32(_mm_set1_epi32(edge2), Steps2), zero);
+			const __m128i inside3 = _mm_cmpgt_epi32(_mm_sub_epi32(_mm_set1_epi32(edge3), Steps3), zero);
+			const __m128i inside = _mm_and_si128(_mm_and_si128(inside1, inside2), inside3);
+			return static_cast<uint32_t>(_mm_movemask_ps(_mm_castsi128_ps(inside)));
+		}
+
+		__m128i Steps1, Steps2, Steps3;
+		int Step1, Step2, Step3;
+#else
+		int Step1, Step2, Step3;
+#endif
+	};
+
+	// The color function is a template parameter rather than a std::function, so the per pixel call inlines. It is one of the
+	// color functions below, taken by value as it keeps the state of the current row.
+	template <typename ColorFunction> void DrawTriangleWithColorFunction(const FixedPointTriangleRenderInfo& renderInfo, ColorFunction colorFunction, Device::TriangleCacheItem* cacheItem)
 	{
 		// Implementation source: https://web.archive.org/web/20171128164608/http://forum.devmaster.net/t/advanced-rasterization/6145.
 		// This is a fixed point implementation that rounds to top-left.
@@ -351,48 +829,171 @@ namespace
 		int edgeStart2 = c2 + deltaX23 * (renderInfo.MinY << 4) - deltaY23 * (renderInfo.MinX << 4);
 		int edgeStart3 = c3 + deltaX31 * (renderInfo.MinY << 4) - deltaY31 * (renderInfo.MinX << 4);
 
-		SDL_Texture* cache = CurrentDevice->MakeTexture(width, height);
-		CurrentDevice->DisableClip();
-		CurrentDevice->UseAsRenderTarget(cache);
+		// The triangle is rasterized on the CPU and uploaded with one call, pixels outside of it stay transparent.
+		// SDL_PIXELFORMAT_RGBA32 has the bytes in the order of Color::ToInt.
+		const int border = TriangleAtlas::Border;
+		const int pitch = width + 2 * border;
+		std::vector<uint32_t>& pixels = CurrentDevice->Pixels;
+		pixels.assign(static_cast<std::size_t>(pitch) * (height + 2 * border), 0);
+
+		// The bounding box is walked in tiles of 8x8 pixels. The edge functions are linear, so over a tile they reach their extremes
+		// in its corners: a tile with all corners on the outside of an edge is skipped, one with all corners inside of every edge
+		// needs no tests, the rest is tested 8 pixels at a time.
+		static constexpr int TileSize = 8;
+		const CoverageTester coverage(fixedDeltaY12, fixedDeltaY23, fixedDeltaY31);
+
+		const auto range = [](int edge, int down, int right, int& minimum, int& maximum) {
+			minimum = edge + std::min(0, down) + std::min(0, right);
+			maximum = edge + std::max(0, down) + std::max(0, right);
+		};
 
-		for (int y = renderInfo.MinY; y < renderInfo.MaxY; y++)
+		for (int tileY = 0; tileY < height; tileY += TileSize)
 		{
-			int edge1 = edgeStart1;
-			int edge2 = edgeStart2;
-			int edge3 = edgeStart3;
+			const int tileHeight = std::min(TileSize, height - tileY);
 
-			for (int x = renderInfo.MinX; x < renderInfo.MaxX; x++)
+			for (int tileX = 0; tileX < width; tileX += TileSize)
 			{
-				if (edge1 > 0 && edge2 > 0 && edge3 > 0)
+				const int tileWidth = std::min(TileSize, width - tileX);
+
+				// Edge values at the top left pixel of the tile.
+				const int tileEdge1 = edgeStart1 + tileY * fixedDeltaX12 - tileX * fixedDeltaY12;
+				const int tileEdge2 = edgeStart2 + tileY * fixedDeltaX23 - tileX * fixedDeltaY23;
+				const int tileEdge3 = edgeStart3 + tileY * fixedDeltaX31 - tileX * fixedDeltaY31;
+
+				int minimum1, maximum1, minimum2, maximum2, minimum3, maximum3;
+				range(tileEdge1, (tileHeight - 1) * fixedDeltaX12, -(tileWidth - 1) * fixedDeltaY12, minimum1, maximum1);
+				range(tileEdge2, (tileHeight - 1) * fixedDeltaX23, -(tileWidth - 1) * fixedDeltaY23, minimum2, maximum2);
+				range(tileEdge3, (tileHeight - 1) * fixedDeltaX31, -(tileWidth - 1) * fixedDeltaY31, minimum3, maximum3);
+
+				if (maximum1 <= 0 || maximum2 <= 0 || maximum3 <= 0) continue;
+
+				const bool isTileInside = minimum1 > 0 && minimum2 > 0 && minimum3 > 0;
+				const uint32_t columns = (1u << tileWidth) - 1;
+
+				for (int row = 0; row < tileHeight; row++)
 				{
-					CurrentDevice->SetAt(x - renderInfo.MinX, y - renderInfo.MinY, colorFunction(x + 0.5f, y + 0.5f));
-				}
+					const int y = tileY + row;
+					uint32_t mask = columns;
+					if (!isTileInside)
+					{
+						mask &= coverage.Test(tileEdge1 + row * fixedDeltaX12, tileEdge2 + row * fixedDeltaX23, tileEdge3 + row * fixedDeltaX31);
+					}
+
+					if (mask == 0) continue;
 
-				edge1 -= fixedDeltaY12;
-				edge2 -= fixedDeltaY23;
-				edge3 -= fixedDeltaY31;
+					colorFunction.BeginRow(renderInfo.MinX + tileX + 0.5f, renderInfo.MinY + y + 0.5f);
+					uint32_t* line = pixels.data() + static_cast<std::size_t>(y + border) * pitch + border + tileX;
+					for (int column = 0; mask != 0; column++, mask >>= 1)
+					{
+						if (mask & 1)
+						{
+							line[column] = colorFunction.At(column);
+						}
+					}
+				}
 			}
+		}
 
-			edgeStart1 += fixedDeltaX12;
-			edgeStart2 += fixedDeltaX23;
-			edgeStart3 += fixedDeltaX31;
+		CurrentDevice->Store(*cacheItem, pixels, width, height);
+	}
+
+	// The color functions are told where every row of pixels starts (the center of its first pixel) and then give the packed color
+	// of the pixel a number of columns to the right of it.
+
+	struct UniformColorFunction
+	{
+		const uint32_t Value;
+
+		void BeginRow(float, float) { }
+		uint32_t At(int) const { return Value; }
+	};
+
+	struct InterpolatedColorFunction
+	{
+		// In the 0 to 255 range.
+		const LinearEquation R, G, B, A;
+		float Row[4];
+
+		InterpolatedColorFunction(const ImDrawVert& v0, const ImDrawVert& v1, const ImDrawVert& v2, float scale)
+			: R(Channel(v0, v1, v2, 0, scale)), G(Channel(v0, v1, v2, 8, scale)), B(Channel(v0, v1, v2, 16, scale)), A(Channel(v0, v1, v2, 24, scale)) { }
+
+		static LinearEquation Channel(const ImDrawVert& v0, const ImDrawVert& v1, const ImDrawVert& v2, int shift, float scale)
+		{
+			const float factor = scale / 255.0f;
+			return LinearEquation(((v0.col >> shift) & 0xff) * factor, ((v1.col >> shift) & 0xff) * factor, ((v2.col >> shift) & 0xff) * factor, v0.pos, v1.pos, v2.pos);
 		}
 
-		CurrentDevice->UseAsRenderTarget(nullptr);
-		CurrentDevice->EnableClip();
+		static int Clamp(float value) { return value <= 0.0f ? 0 : value >= 255.0f ? 255 : static_cast<int>(value); }
 
-		cacheItem->Texture = cache;
-		cacheItem->Width = width;
-		cacheItem->Height = height;
-	}
+		void BeginRow(float x, float y)
+		{
+			Row[0] = R.Evaluate(x, y);
+			Row[1] = G.Evaluate(x, y);
+			Row[2] = B.Evaluate(x, y);
+			Row[3] = A.Evaluate(x, y);
+		}
+
+		uint32_t At(int column) const
+		{
+			const float offset = static_cast<float>(column);
+			return static_cast<uint32_t>(Clamp(Row[0] + R.DX * offset))
+				| (static_cast<uint32_t>(Clamp(Row[1] + G.DX * offset)) << 8)
+				| (static_cast<uint32_t>(Clamp(Row[2] + B.DX * offset)) << 16)
+				| (static_cast<uint32_t>(Clamp(Row[3] + A.DX * offset)) << 24);
+		}
+	};
+
+	struct TexturedColorFunction
+	{
+		// The vertex colors in the 0 to 1 range, they scale the 0 to 255 texels.
+		InterpolatedColorFunction Shade;
+		// Texture coordinates in texels.
+		const LinearEquation U, V;
+		const Texture* Source;
+		// 16.16 fixed point texel coordinates at the start of the row and their step to the next column.
+		int RowU = 0, RowV = 0;
+		const int StepU, StepV;
+
+		TexturedColorFunction(const ImDrawVert& v0, const ImDrawVert& v1, const ImDrawVert& v2, const Texture* source)
+			: Shade(v0, v1, v2, 1.0f),
+			U(Texel(v0.uv.x, source->Surface->w), Texel(v1.uv.x, source->Surface->w), Texel(v2.uv.x, source->Surface->w), v0.pos, v1.pos, v2.pos),
+			V(Texel(v0.uv.y, source->Surface->h), Texel(v1.uv.y, source->Surface->h), Texel(v2.uv.y, source->Surface->h), v0.pos, v1.pos, v2.pos),
+			Source(source), StepU(Fixed(U.DX)), StepV(Fixed(V.DX)) { }
+
+		// The texel a coordinate samples is the integer part of this, the same as rounding u * (size - 1) + 0.5.
+		static float Texel(float coordinate, int size) { return coordinate * (size - 1) + 1.0f; }
+		static int Fixed(float value) { return static_cast<int>(value * 65536.0f); }
+
+		void BeginRow(float x, float y)
+		{
+			Shade.BeginRow(x, y);
+			RowU = Fixed(U.Evaluate(x, y));
+			RowV = Fixed(V.Evaluate(x, y));
+		}
+
+		uint32_t At(int column) const
+		{
+			const uint32_t texel = Source->At(RowU + StepU * column, RowV + StepV * column);
+			const float offset = static_cast<float>(column);
+			// The shade drifts slightly outside 0 to 1 at the triangle edges, keep every channel in its byte.
+			return static_cast<uint32_t>(InterpolatedColorFunction::Clamp(((texel >> 0) & 0xff) * (Shade.Row[0] + Shade.R.DX * offset)))
+				| (static_cast<uint32_t>(InterpolatedColorFunction::Clamp(((texel >> 8) & 0xff) * (Shade.Row[1] + Shade.G.DX * offset))) << 8)
+				| (static_cast<uint32_t>(InterpolatedColorFunction::Clamp(((texel >> 16) & 0xff) * (Shade.Row[2] + Shade.B.DX * offset))) << 16)
+				| (static_cast<uint32_t>(InterpolatedColorFunction::Clamp(((texel >> 24) & 0xff) * (Shade.Row[3] + Shade.A.DX * offset))) << 24);
+		}
+	};
 
 	void DrawCachedTriangle(const Device::TriangleCacheItem& triangle, const FixedPointTriangleRenderInfo& renderInfo)
 	{
+		SDL_Rect source;
+		SDL_Texture* texture = triangle.GetSource(source);
+		if (!texture) return;
+
 		const SDL_Rect destination = { renderInfo.MinX, renderInfo.MinY, triangle.Width, triangle.Height };
-		SDL_RenderCopy(CurrentDevice->Renderer, triangle.Texture, nullptr, &destination);
+		SDL_RenderCopy(CurrentDevice->Renderer, texture, &source, &destination);
 	}
 
-	void DrawTriangle(const ImDrawVert& v1, const ImDrawVert& v2, const ImDrawVert& v3, const Texture* texture)
+	void DrawTriangle(const ImDrawVert& v1, const ImDrawVert& v2, const ImDrawVert& v3, const Texture* texture, bool usesOnlyColor)
 	{
 		// The naming inconsistency in the parameters is intentional. The fixed point algorithm wants the vertices in a counter clockwise order.
 		const auto& renderInfo = FixedPointTriangleRenderInfo::CalculateFixedPointTriangleInfo(v3.pos, v2.pos, v1.pos);
@@ -404,35 +1005,27 @@ namespace
 			std::make_tuple(static_cast<int>(std::round(v2.pos.x)) - renderInfo.MinX, static_cast<int>(std::round(v2.pos.y)) - renderInfo.MinY, v2.uv.x, v2.uv.y, v2.col),
 			std::make_tuple(static_cast<int>(std::round(v3.pos.x)) - renderInfo.MinX, static_cast<int>(std::round(v3.pos.y)) - renderInfo.MinY, v3.uv.x, v3.uv.y, v3.col));
 
-		if (CurrentDevice->GenericTriangleCache.Contains(key))
+		auto* found = CurrentDevice->GenericTriangleCache.Find(key);
+		if (found && !found->IsStale())
 		{
-			const auto& cached = CurrentDevice->GenericTriangleCache.At(key);
-			DrawCachedTriangle(*cached, renderInfo);
+			DrawCachedTriangle(*found, renderInfo);
 
 			return;
 		}
 
-		const InterpolatedFactorEquation<float> textureU(v1.uv.x, v2.uv.x, v3.uv.x, v1.pos, v2.pos, v3.pos);
-		const InterpolatedFactorEquation<float> textureV(v1.uv.y, v2.uv.y, v3.uv.y, v1.pos, v2.pos, v3.pos);
-
-		const InterpolatedFactorEquation<Color> shadeColor(Color(v1.col), Color(v2.col), Color(v3.col), v1.pos, v2.pos, v3.pos);
-
-		auto cached = std::make_unique<Device::TriangleCacheItem>();
-		DrawTriangleWithColorFunction(renderInfo, [&](float x, float y) {
-			const float u = textureU.Evaluate(x, y);
-			const float v = textureV.Evaluate(x, y);
-			const Color sampled = texture->Sample(u, v);
-			const Color shade = shadeColor.Evaluate(x, y);
-
-			return sampled * shade;
-		}, cached.get());
-
-		if (!cached->Texture) return;
-
-		const SDL_Rect destination = { renderInfo.MinX, renderInfo.MinY, cached->Width, cached->Height };
-		SDL_RenderCopy(CurrentDevice->Renderer, cached->Texture, nullptr, &destination);
+		auto& cached = found ? *found : CurrentDevice->GenericTriangleCache.Insert(key);
+		cached = Device::TriangleCacheItem();
+		if (usesOnlyColor)
+		{
+			// Every pixel samples the white pixel of the font, only the vertex colors matter.
+			DrawTriangleWithColorFunction(renderInfo, InterpolatedColorFunction(v1, v2, v3, 255.0f), &cached);
+		}
+		else
+		{
+			DrawTriangleWithColorFunction(renderInfo, TexturedColorFunction(v1, v2, v3, texture), &cached);
+		}
 
-		CurrentDevice->GenericTriangleCache.Insert(key, std::move(cached));
+		DrawCachedTriangle(cached, renderInfo);
 	}
 
 	void DrawUniformColorTriangle(const ImDrawVert& v1, const ImDrawVert& v2, const ImDrawVert& v3)
@@ -446,23 +1039,19 @@ namespace
 			static_cast<int>(std::round(v1.pos.x)) - renderInfo.MinX, static_cast<int>(std::round(v1.pos.y)) - renderInfo.MinY,
 			static_cast<int>(std::round(v2.pos.x)) - renderInfo.MinX, static_cast<int>(std::round(v2.pos.y)) - renderInfo.MinY,
 			static_cast<int>(std::round(v3.pos.x)) - renderInfo.MinX, static_cast<int>(std::round(v3.pos.y)) - renderInfo.MinY);
-		if (CurrentDevice->UniformColorTriangleCache.Contains(key))
+		auto* found = CurrentDevice->UniformColorTriangleCache.Find(key);
+		if (found && !found->IsStale())
 		{
-			const auto& cached = CurrentDevice->UniformColorTriangleCache.At(key);
-			DrawCachedTriangle(*cached, renderInfo);
+			DrawCachedTriangle(*found, renderInfo);
 
 			return;
 		}
 
-		auto cached = std::make_unique<Device::TriangleCacheItem>();
-		DrawTriangleWithColorFunction(renderInfo, [&color](float, float) { return color; }, cached.get());
-
-		if (!cached->Texture) return;
+		auto& cached = found ? *found : CurrentDevice->UniformColorTriangleCache.Insert(key);
+		cached = Device::TriangleCacheItem();
+		DrawTriangleWithColorFunction(renderInfo, UniformColorFunction{ color.ToInt() }, &cached);
 
-		const SDL_Rect destination = { renderInfo.MinX, renderInfo.MinY, cached->Width, cached->Height };
-		SDL_RenderCopy(CurrentDevice->Renderer, cached->Texture, nullptr, &destination);
-
-		CurrentDevice->UniformColorTriangleCache.Insert(key, std::move(cached));
+		DrawCachedTriangle(cached, renderInfo);
 	}
 
 	void DrawRectangle(const Rect& bounding, SDL_Texture* texture, int textureWidth, int textureHeight, const Color& color, bool doHorizontalFlip, bool doVerticalFlip)
@@ -511,60 +1100,75 @@ namespace
 		SDL_QueryTexture(texture, nullptr, nullptr, &width, &height);
 		DrawRectangle(bounding, texture, width, height, color, doHorizontalFlip, doVerticalFlip);
 	}
-}
 
-namespace ImGuiSDL
-{
-	void Initialize(SDL_Renderer* renderer, int windowWidth, int windowHeight)
+	bool DrawGeometry(const ImDrawList* commandList, const ImDrawCmd* drawCommand, const ImDrawIdx* indexBuffer)
 	{
-		ImGuiIO& io = ImGui::GetIO();
-		io.DisplaySize.x = static_cast<float>(windowWidth);
-		io.DisplaySize.y = static_cast<float>(windowHeight);
-
-		ImGui::GetStyle().WindowRounding = 0.0f;
-		ImGui::GetStyle().AntiAliasedFill = false;
-		ImGui::GetStyle().AntiAliasedLines = false;
-
-		// Loads the font texture.
-		unsigned char* pixels;
-		int width, height;
-		io.Fonts->GetTexDataAsRGBA32(&pixels, &width, &height);
-		static constexpr uint32_t rmask = 0x000000ff, gmask = 0x0000ff00, bmask = 0x00ff0000, amask = 0xff000000;
-		SDL_Surface* surface = SDL_CreateRGBSurfaceFrom(pixels, width, height, 32, 4 * width, rmask, gmask, bmask, amask);
-
-		Texture* texture = new Texture();
-		texture->Surface = surface;
-		texture->Source = SDL_CreateTextureFromSurface(renderer, surface);
-		io.Fonts->TexID = (void*)texture;
-
-		CurrentDevice = new Device(renderer);
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+		const bool isWrappedTexture = drawCommand->TextureId == ImGui::GetIO().Fonts->TexID;
+		SDL_Texture* texture = isWrappedTexture ? static_cast<const Texture*>(drawCommand->TextureId)->Source : static_cast<SDL_Texture*>(drawCommand->TextureId);
+
+		// The rectangle path tints textures with the color mod, here the vertex colors do it.
+		if (texture) SDL_SetTextureColorMod(texture, 255, 255, 255);
+
+		// The raw variant reads the positions, colors and texture coordinates straight out of the ImDrawVert array. ImGui packs
+		// the color as R, G, B, A bytes, which is the layout of SDL_Color. SDL 2.0.18 declared the colors as int.
+		const ImDrawVert* vertices = commandList->VtxBuffer.Data + drawCommand->VtxOffset;
+		const int stride = static_cast<int>(sizeof(ImDrawVert));
+#if SDL_VERSION_ATLEAST(2, 0, 19)
+		const SDL_Color* colors = reinterpret_cast<const SDL_Color*>(&vertices->col);
+#else
+		const int* colors = reinterpret_cast<const int*>(&vertices->col);
+#endif
+		return SDL_RenderGeometryRaw(CurrentDevice->Renderer, texture,
+			&vertices->pos.x, stride,
+			colors, stride,
+			&vertices->uv.x, stride,
+			commandList->VtxBuffer.Size - static_cast<int>(drawCommand->VtxOffset),
+			indexBuffer, static_cast<int>(drawCommand->ElemCount), static_cast<int>(sizeof(ImDrawIdx))) == 0;
+#else
+		return false;
+#endif
 	}
 
-	void Deinitialize()
+	// Hash of everything in the draw data that ends up on the screen. The buffers are taken in words of 8 bytes, it has to be
+	// cheaper than drawing the UI. Textures count by their id only, which holds for the static font atlas. A texture of the
+	// program whose pixels change needs a ClearCache, the layer would show it stale otherwise.
+	uint64_t Fingerprint(const ImDrawData* drawData)
 	{
-		// Frees up the memory of the font texture.
-		ImGuiIO& io = ImGui::GetIO();
-		Texture* texture = static_cast<Texture*>(io.Fonts->TexID);
-		delete texture;
+		uint64_t hash = 0xcbf29ce484222325ull;
+		const auto add = [&hash](const void* data, std::size_t size) {
+			const unsigned char* bytes = static_cast<const unsigned char*>(data);
+			for (; size > 0; bytes += 8, size -= std::min<std::size_t>(size, 8))
+			{
+				uint64_t word = 0;
+				std::memcpy(&word, bytes, std::min<std::size_t>(size, 8));
+				hash = (hash ^ word) * 0x9e3779b97f4a7c15ull;
+				hash ^= hash >> 32;
+			}
+		};
 
-		delete CurrentDevice;
+		add(&drawData->DisplayPos, sizeof(drawData->DisplayPos));
+		add(&drawData->DisplaySize, sizeof(drawData->DisplaySize));
+		for (int n = 0; n < drawData->CmdListsCount; n++)
+		{
+			const ImDrawList* commandList = drawData->CmdLists[n];
+			add(commandList->VtxBuffer.Data, commandList->VtxBuffer.Size * sizeof(ImDrawVert));
+			add(commandList->IdxBuffer.Data, commandList->IdxBuffer.Size * sizeof(ImDrawIdx));
+			for (const ImDrawCmd& drawCommand : commandList->CmdBuffer)
+			{
+				add(&drawCommand.ClipRect, sizeof(drawCommand.ClipRect));
+				add(&drawCommand.TextureId, sizeof(drawCommand.TextureId));
+				add(&drawCommand.VtxOffset, sizeof(drawCommand.VtxOffset));
+				add(&drawCommand.IdxOffset, sizeof(drawCommand.IdxOffset));
+				add(&drawCommand.ElemCount, sizeof(drawCommand.ElemCount));
+				add(&drawCommand.UserCallback, sizeof(drawCommand.UserCallback));
+			}
+		}
+		return hash;
 	}
 
-	void Render(ImDrawData* drawData)
+	void DrawCommands(ImDrawData* drawData)
 	{
-		SDL_BlendMode blendMode;
-		SDL_GetRenderDrawBlendMode(CurrentDevice->Renderer, &blendMode);
-		SDL_SetRenderDrawBlendMode(CurrentDevice->Renderer, SDL_BLENDMODE_BLEND);
-
-		Uint8 initialR, initialG, initialB, initialA;
-		SDL_GetRenderDrawColor(CurrentDevice->Renderer, &initialR, &initialG, &initialB, &initialA);
-
-		SDL_bool initialClipEnabled = SDL_RenderIsClipEnabled(CurrentDevice->Renderer);
-		SDL_Rect initialClipRect;
-		SDL_RenderGetClipRect(CurrentDevice->Renderer, &initialClipRect);
-
-		SDL_Texture* initialRenderTarget = SDL_GetRenderTarget(CurrentDevice->Renderer);
-
 		ImGuiIO& io = ImGui::GetIO();
 
 		for (int n = 0; n < drawData->CmdListsCount; n++)
@@ -589,8 +1193,19 @@ namespace ImGuiSDL
 				{
 					drawCommand->UserCallback(commandList, drawCommand);
 				}
+				else if (clipRect.Width <= 0 || clipRect.Height <= 0)
+				{
+					// Nothing of the command is visible. SDL would take an empty clip rect as no clipping at all.
+				}
+				else if (CurrentDevice->UseGeometry && DrawGeometry(commandList, drawCommand, indexBuffer))
+				{
+					// The whole command went out in one batch.
+				}
 				else
 				{
+					// A renderer that fails the batch (or has none) keeps using the triangle caches from now on.
+					CurrentDevice->UseGeometry = false;
+
 					const bool isWrappedTexture = drawCommand->TextureId == io.Fonts->TexID;
 
 					// Loops over triangles.
@@ -602,6 +1217,10 @@ namespace ImGuiSDL
 
 						const Rect& bounding = Rect::CalculateBoundingBox(v0, v1, v2);
 
+						// Triangles the clip rect hides completely never reach the caches or the rasterizer. Both triangles of a rectangle
+						// have its bounding box, so a hidden rectangle is dropped one triangle at a time.
+						if (bounding.IsOutside(clipRect)) continue;
+
 						const bool isTriangleUniformColor = v0.col == v1.col && v1.col == v2.col;
 						const bool doesTriangleUseOnlyColor = bounding.UsesOnlyColor();
 
@@ -653,7 +1272,7 @@ namespace ImGuiSDL
 						{
 							// Currently we assume that any non rectangular texture samples the font texture. Dunno if that's what actually happens, but it seems to work.
 							assert(isWrappedTexture);
-							DrawTriangle(v0, v1, v2, static_cast<const Texture*>(drawCommand->TextureId));
+							DrawTriangle(v0, v1, v2, static_cast<const Texture*>(drawCommand->TextureId), doesTriangleUseOnlyColor);
 						}
 					}
 				}
@@ -661,6 +1280,148 @@ namespace ImGuiSDL
 				indexBuffer += drawCommand->ElemCount;
 			}
 		}
+	}
+}
+
+namespace ImGuiSDL
+{
+	void Initialize(SDL_Renderer* renderer, int windowWidth, int windowHeight)
+	{
+		ImGuiIO& io = ImGui::GetIO();
+		io.DisplaySize.x = static_cast<float>(windowWidth);
+		io.DisplaySize.y = static_cast<float>(windowHeight);
+
+		ImGui::GetStyle().WindowRounding = 0.0f;
+		ImGui::GetStyle().AntiAliasedFill = false;
+		ImGui::GetStyle().AntiAliasedLines = false;
+
+		// Loads the font texture.
+		unsigned char* pixels;
+		int width, height;
+		io.Fonts->GetTexDataAsRGBA32(&pixels, &width, &height);
+		static constexpr uint32_t rmask = 0x000000ff, gmask = 0x0000ff00, bmask = 0x00ff0000, amask = 0xff000000;
+		SDL_Surface* surface = SDL_CreateRGBSurfaceFrom(pixels, width, height, 32, 4 * width, rmask, gmask, bmask, amask);
+
+		Texture* texture = new Texture();
+		texture->Surface = surface;
+		texture->Source = SDL_CreateTextureFromSurface(renderer, surface);
+		io.Fonts->TexID = (void*)texture;
+
+		CurrentDevice = new Device(renderer);
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+		// The program can run against an older SDL than the headers it was built with.
+		SDL_version linked;
+		SDL_GetVersion(&linked);
+		CurrentDevice->GeometrySupported = SDL_VERSIONNUM(linked.major, linked.minor, linked.patch) >= SDL_VERSIONNUM(2, 0, 18);
+#endif
+		CurrentDevice->UseGeometry = CurrentDevice->GeometrySupported;
+	}
+
+	void Deinitialize()
+	{
+		// Frees up the memory of the font texture.
+		ImGuiIO& io = ImGui::GetIO();
+		Texture* texture = static_cast<Texture*>(io.Fonts->TexID);
+		delete texture;
+
+		delete CurrentDevice;
+	}
+
+	void ClearCache(bool keepTextures)
+	{
+		// The cached triangles give their regions back to the atlas and their textures to the pool.
+		CurrentDevice->UniformColorTriangleCache.Clear();
+		CurrentDevice->GenericTriangleCache.Clear();
+		if (keepTextures)
+		{
+			CurrentDevice->Layer.Valid = false;
+			return;
+		}
+		CurrentDevice->Atlas.Clear();
+		CurrentDevice->Pool.Clear();
+		CurrentDevice->Layer.Clear();
+	}
+
+	void GetCacheStats(CacheStats& uniformColor, CacheStats& generic)
+	{
+		const auto read = [](const auto& cache, CacheStats& stats) {
+			stats.Entries = static_cast<int>(cache.GetCount());
+			stats.Capacity = static_cast<int>(cache.GetCapacity());
+			stats.Hits = cache.Hits;
+			stats.Misses = cache.Misses;
+			stats.Evictions = cache.Evictions;
+		};
+		read(CurrentDevice->UniformColorTriangleCache, uniformColor);
+		read(CurrentDevice->GenericTriangleCache, generic);
+	}
+
+	void GetTexturePoolStats(TexturePoolStats& stats)
+	{
+		stats.Textures = CurrentDevice->Pool.Textures;
+		stats.Pixels = CurrentDevice->Pool.Pixels;
+		stats.Created = CurrentDevice->Pool.Created;
+		stats.Reused = CurrentDevice->Pool.Reused;
+	}
+
+	void SetGeometryEnabled(bool enabled)
+	{
+		CurrentDevice->UseGeometry = enabled && CurrentDevice->GeometrySupported;
+	}
+
+	bool IsGeometryEnabled()
+	{
+		return CurrentDevice->UseGeometry;
+	}
+
+	void Render(ImDrawData* drawData)
+	{
+		SDL_BlendMode blendMode;
+		SDL_GetRenderDrawBlendMode(CurrentDevice->Renderer, &blendMode);
+		SDL_SetRenderDrawBlendMode(CurrentDevice->Renderer, SDL_BLENDMODE_BLEND);
+
+		Uint8 initialR, initialG, initialB, initialA;
+		SDL_GetRenderDrawColor(CurrentDevice->Renderer, &initialR, &initialG, &initialB, &initialA);
+
+		SDL_bool initialClipEnabled = SDL_RenderIsClipEnabled(CurrentDevice->Renderer);
+		SDL_Rect initialClipRect;
+		SDL_RenderGetClipRect(CurrentDevice->Renderer, &initialClipRect);
+
+		SDL_Texture* initialRenderTarget = SDL_GetRenderTarget(CurrentDevice->Renderer);
+
+		// The layer has as many pixels as the UI covers on the screen, so it looks the same as when it is drawn straight to it.
+		float scaleX, scaleY;
+		SDL_RenderGetScale(CurrentDevice->Renderer, &scaleX, &scaleY);
+		const int width = static_cast<int>(drawData->DisplaySize.x);
+		const int height = static_cast<int>(drawData->DisplaySize.y);
+
+		UILayer& layer = CurrentDevice->Layer;
+		if (layer.Prepare(static_cast<int>(std::ceil(width * scaleX)), static_cast<int>(std::ceil(height * scaleY))))
+		{
+			const uint64_t fingerprint = Fingerprint(drawData);
+			if (!layer.Valid || layer.Fingerprint != fingerprint)
+			{
+				SDL_SetRenderTarget(CurrentDevice->Renderer, layer.Texture);
+				SDL_RenderSetScale(CurrentDevice->Renderer, scaleX, scaleY);
+				SDL_SetRenderDrawColor(CurrentDevice->Renderer, 0, 0, 0, 0);
+				SDL_RenderClear(CurrentDevice->Renderer);
+
+				DrawCommands(drawData);
+
+				CurrentDevice->DisableClip();
+				SDL_SetRenderTarget(CurrentDevice->Renderer, initialRenderTarget);
+				layer.Fingerprint = fingerprint;
+				layer.Valid = true;
+			}
+
+			const SDL_Rect destination = { 0, 0, width, height };
+			SDL_RenderSetClipRect(CurrentDevice->Renderer, nullptr);
+			SDL_RenderCopy(CurrentDevice->Renderer, layer.Texture, nullptr, &destination);
+		}
+		else
+		{
+			DrawCommands(drawData);
+		}
 
 		CurrentDevice->DisableClip();
 
@@ -12,6 +12,34 @@ namespace ImGuiSDL
 	void Deinitialize();
 
 	// Call this every frame after ImGui::Render with ImGui::GetDrawData(). This will use the SDL_Renderer provided to the interfrace with Initialize
-	// to draw the contents of the draw data to the screen.
+	// to draw the contents of the draw data to the screen. Renderers with custom blend modes keep the UI in a texture that is copied again
+	// while the draw data stays the same, call ClearCache when a texture the UI shows changes its contents.
 	void Render(ImDrawData* drawData);
+
+	// Call this when the renderer reports SDL_RENDER_TARGETS_RESET or SDL_RENDER_DEVICE_RESET, the cached triangles
+	// live in textures whose contents can be gone then. With keepTextures only the triangles are forgotten, the atlas
+	// pages and the pooled textures stay for the next ones to be rasterized into.
+	void ClearCache(bool keepTextures = false);
+
+	// Use of the triangle caches, the counters keep running through ClearCache.
+	struct CacheStats
+	{
+		int Entries, Capacity;
+		unsigned long long Hits, Misses, Evictions;
+	};
+	void GetCacheStats(CacheStats& uniformColor, CacheStats& generic);
+
+	// Textures waiting for reuse by triangles too large for the atlas, and how many were created and reused since the start.
+	struct TexturePoolStats
+	{
+		int Textures;
+		long long Pixels;
+		unsigned long long Created, Reused;
+	};
+	void GetTexturePoolStats(TexturePoolStats& stats);
+
+	// When SDL 2.0.18 or newer is available, every draw command is submitted as a single SDL_RenderGeometry batch. This is the
+	// default, disabling it (or an older SDL) rasterizes every triangle into the triangle caches instead.
+	void SetGeometryEnabled(bool enabled);
+	bool IsGeometryEnabled();
 }